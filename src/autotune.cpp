@@ -0,0 +1,219 @@
+#include "autotune.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common.hpp"
+#include "copykernel.hpp"
+#include "misc.hpp"
+#include "workerpool.hpp"
+
+namespace{
+
+const std::size_t page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+
+std::size_t default_chunk_size(std::size_t n, std::size_t jobs, std::size_t chunk)
+{
+    // by default, each of the jobs gets 8 chunks, to have some to be stolen.
+    if(chunk == 0){
+        chunk = n / (jobs * 8);
+    }
+    // the chunks are counted in 32 bits by chunk_scheduler.
+    chunk = std::max(chunk, n >> 31);
+    return std::max((chunk + page_size - 1) & ~(page_size - 1), page_size);
+}
+
+} // namespace
+
+const calibration& calibration::get(const param& prm)
+{
+    static std::mutex mutex;
+    static std::map<std::pair<std::size_t, copy_kernel>, std::unique_ptr<calibration>> calibrations;
+
+    const std::size_t max_jobs = static_cast<std::size_t>(prm.jobs);
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<calibration>& c = calibrations[std::make_pair(max_jobs, prm.kernel)];
+    if(c){
+        return *c;
+    }
+
+    c.reset(new calibration(max_jobs, prm.kernel));
+    const std::string file = path();
+    if(1 < max_jobs && (file.empty() || !c->load(file)) && c->measure(prm) && !file.empty()){
+        c->store(file);
+    }
+    return *c;
+}
+
+std::string calibration::path()
+{
+    const char* cache_home = std::getenv("XDG_CACHE_HOME");
+    if(cache_home && *cache_home){
+        return std::string(cache_home) + "/masterkey/calibration";
+    }
+    const char* home = std::getenv("HOME");
+    if(home && *home){
+        return std::string(home) + "/.cache/masterkey/calibration";
+    }
+    return std::string();
+}
+
+calibration::calibration(std::size_t max_jobs, copy_kernel kernel)
+: max_jobs_(max_jobs),
+kernel_(kernel),
+memory_crossover_(SIZE_MAX),
+file_crossover_(SIZE_MAX)
+{}
+
+bool calibration::load(const std::string& file)
+{
+    std::ifstream ifs(file);
+    std::size_t jobs = 0;
+    std::size_t kernel = SIZE_MAX;
+    std::size_t memory = 0;
+    std::size_t to_file = 0;
+    for(std::string key; ifs >> key;){
+        std::size_t value = 0;
+        if(key[0] == '#'){
+            std::getline(ifs, key);
+            continue;
+        }
+        if(!(ifs >> value)){
+            return false;
+        }
+        if(key == "jobs"){
+            jobs = value;
+        }else if(key == "kernel"){
+            kernel = value;
+        }else if(key == "memory"){
+            memory = value;
+        }else if(key == "file"){
+            to_file = value;
+        }
+    }
+    // a calibration for another number of jobs, or another kernel, is measured again.
+    if(jobs != max_jobs_ || kernel != static_cast<std::size_t>(kernel_)
+            || memory == 0 || to_file == 0){
+        return false;
+    }
+    memory_crossover_ = memory;
+    file_crossover_ = to_file;
+    return true;
+}
+
+void calibration::store(const std::string& file)const
+{
+    // the directories are created one by one from the cache home.
+    for(std::size_t pos = file.find('/', 1); pos != std::string::npos; pos = file.find('/', pos + 1)){
+        if(mkdir(file.substr(0, pos).c_str(), 0755) == -1 && errno != EEXIST){
+            WARN(std::string("mkdir: ") + std::strerror(errno) + ": " + file.substr(0, pos));
+            return;
+        }
+    }
+
+    // written aside and renamed, so that no one reads it half written.
+    const std::string tmp = file + '.' + std::to_string(getpid());
+    {
+        std::ofstream ofs(tmp);
+        ofs << "# the smallest copies, in bytes, which get faster with more than one thread.\n"
+            << "jobs " << max_jobs_ << '\n'
+            << "kernel " << static_cast<std::size_t>(kernel_) << '\n'
+            << "memory " << memory_crossover_ << '\n'
+            << "file " << file_crossover_ << '\n';
+        if(!ofs){
+            WARN("can't write the calibration: " + tmp);
+            return;
+        }
+    }
+    if(rename(tmp.c_str(), file.c_str()) == -1){
+        WARN(std::string("rename: ") + std::strerror(errno) + ": " + file);
+        unlink(tmp.c_str());
+    }
+}
+
+bool calibration::measure(const param& prm)
+{
+    using clock = std::chrono::steady_clock;
+    const std::size_t max_size = 16ul << 20;
+
+    std::vector<char> src(max_size, 'x');
+    std::vector<char> dst(max_size, 0);
+    const int fd = memfd_create("masterkey-calibration", MFD_CLOEXEC);
+    if(fd == -1 || ftruncate(fd, static_cast<off_t>(max_size)) == -1){
+        WARN(std::string("memfd: ") + std::strerror(errno));
+        if(fd != -1){
+            close(fd);
+        }
+        return false;
+    }
+
+    // memory is copied in the same way as target::iohelper::memcpy() does.
+    worker_pool& pool = worker_pool::instance(prm.scheduling_policy, max_jobs_, prm.cpus);
+    const auto copy = [&](copy_destination dest, std::size_t n, std::size_t jobs){
+        const copy_function copy_memory = select_copy_kernel(kernel_);
+        const bool nontemporal = effective_nontemporal_threshold(prm.nontemporal_threshold) <= n;
+        const std::size_t chunk = default_chunk_size(n, jobs, 0);
+        const clock::time_point start = clock::now();
+        pool.run_chunked(0, n, chunk, jobs, [&](std::size_t first, std::size_t last){
+            if(dest == copy_destination::MEMORY){
+                copy_memory(dst.data() + first, src.data() + first, last - first, nontemporal);
+            }else if(pwrite(fd, src.data() + first, last - first, static_cast<off_t>(first)) == -1){
+                ERROR_THROW("pwrite");
+            }
+        });
+        return clock::now() - start;
+    };
+
+    // the best of a few runs, the first of which faults the pages in.
+    const auto best_of = [&](copy_destination dest, std::size_t n, std::size_t jobs){
+        clock::duration best = clock::duration::max();
+        for(int i = 0; i < 4; ++i){
+            best = std::min(best, copy(dest, n, jobs));
+        }
+        return best;
+    };
+
+    bool measured = true;
+    try{
+        for(const copy_destination dest: {copy_destination::MEMORY, copy_destination::DESCRIPTOR}){
+            std::size_t& crossover = dest == copy_destination::MEMORY ? memory_crossover_ : file_crossover_;
+            // if no size measured pays off, the threads are left to the copies
+            // larger than any of them, which pay off more, the larger they are.
+            crossover = max_size << 2;
+            for(std::size_t n = 16ul << 10; n <= max_size; n <<= 2){
+                // more threads have to be faster by 10%, to be worth waking them up.
+                if(best_of(dest, n, max_jobs_) * 10 < best_of(dest, n, 1) * 9){
+                    crossover = n;
+                    break;
+                }
+            }
+        }
+    }catch(const std::exception&){
+        memory_crossover_ = file_crossover_ = SIZE_MAX;
+        measured = false;
+    }
+    close(fd);
+    return measured;
+}
+
+copy_split split_copy(std::size_t n, copy_destination dest, const param& prm)
+{
+    std::size_t jobs = static_cast<std::size_t>(prm.jobs);
+    if(prm.auto_jobs && 1 < jobs){
+        const std::size_t crossover = calibration::get(prm).crossover(dest);
+        jobs = n < crossover ? 1 : std::min(jobs, n / std::max<std::size_t>(crossover / 2, 1));
+    }
+    return copy_split{jobs, default_chunk_size(n, jobs, prm.chunk_size)};
+}
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
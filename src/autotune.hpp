@@ -0,0 +1,58 @@
+#ifndef AUTOTUNE_HPP_
+#define AUTOTUNE_HPP_
+
+#include <cstddef>
+#include <string>
+#include "fwd.hpp"
+
+// what the copied bytes go to, which costs differently per thread.
+enum class copy_destination{
+    MEMORY,     // a mapped region, by memcpy.
+    DESCRIPTOR, // a file, by pwrite.
+};
+
+// the smallest copies which get faster with more than one thread, measured
+// with a short benchmark while setting up -j auto, and kept in a cache file.
+class calibration{
+public:
+    // of up to --jobs threads with --copy-kernel. loaded from path() if it's there
+    // for the same, or measured with the threads of 'prm', and stored otherwise.
+    // a measurement which fails is not stored, and leaves the copies unsplit.
+    static const calibration& get(const param& prm);
+    // $XDG_CACHE_HOME/masterkey/calibration, or ~/.cache/masterkey/calibration.
+    // empty if neither of them is known.
+    static std::string path();
+
+    std::size_t crossover(copy_destination dest)const
+    {
+        return dest == copy_destination::MEMORY ? memory_crossover_ : file_crossover_;
+    }
+
+private:
+    calibration(std::size_t max_jobs, copy_kernel kernel);
+
+    bool load(const std::string& file);
+    void store(const std::string& file)const;
+    bool measure(const param& prm);
+
+    const std::size_t max_jobs_;
+    const copy_kernel kernel_;
+    std::size_t memory_crossover_;
+    std::size_t file_crossover_;
+};
+
+// how a copy of n bytes is split among the jobs.
+struct copy_split{
+    std::size_t jobs;
+    // a multiple of the page size.
+    std::size_t chunk_size;
+};
+
+// with -j auto, a copy smaller than the crossover runs on the calling thread alone,
+// and a larger one gets a thread per half of the crossover, up to --jobs.
+// otherwise, all of --jobs take part. the chunks are --chunk-size, if given.
+copy_split split_copy(std::size_t n, copy_destination dest, const param& prm);
+
+#endif // AUTOTUNE_HPP_
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
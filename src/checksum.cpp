@@ -0,0 +1,243 @@
+#include "checksum.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include "misc.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+checksum_algorithm to_checksum_algorithm(const std::string& str)
+{
+    if(str == "none"){
+        return checksum_algorithm::NONE;
+    }else if(str == "auto"){
+        return checksum_algorithm::AUTO;
+    }else if(str == "crc32c"){
+        return checksum_algorithm::CRC32C;
+    }else if(str == "hash64"){
+        return checksum_algorithm::HASH64;
+    }else{
+        errno = EINVAL;
+        ERROR_THROW("invalid checksum");
+    }
+}
+
+namespace{
+
+// crc32c, the castagnoli polynomial, reflected.
+constexpr std::uint32_t crc32c_polynomial = 0x82f63b78u;
+
+struct crc32c_tables{
+    std::uint32_t bytes[256];
+    // x^(2^n) modulo the polynomial, to shift a crc over 2^n bits at once.
+    std::uint32_t x2n[32];
+
+    crc32c_tables()
+    {
+        for(std::uint32_t i = 0; i < 256; ++i){
+            std::uint32_t c = i;
+            for(int k = 0; k < 8; ++k){
+                c = c & 1 ? (c >> 1) ^ crc32c_polynomial : c >> 1;
+            }
+            bytes[i] = c;
+        }
+        x2n[0] = 1u << 30;
+        for(int n = 1; n < 32; ++n){
+            x2n[n] = multiply(x2n[n - 1], x2n[n - 1]);
+        }
+    }
+
+    // a * b modulo the polynomial, in the reflected order, where 1u << 31 is x^0.
+    static std::uint32_t multiply(std::uint32_t a, std::uint32_t b)
+    {
+        std::uint32_t m = 1u << 31;
+        std::uint32_t p = 0;
+        for(;;){
+            if(a & m){
+                p ^= b;
+                if((a & (m - 1)) == 0){
+                    return p;
+                }
+            }
+            m >>= 1;
+            b = b & 1 ? (b >> 1) ^ crc32c_polynomial : b >> 1;
+        }
+    }
+
+    // x^(8 * n) modulo the polynomial.
+    std::uint32_t shift(std::size_t n)const
+    {
+        std::uint32_t p = 1u << 31;
+        for(int k = 3; n != 0; n >>= 1, k = (k + 1) & 31){
+            if(n & 1){
+                p = multiply(x2n[k], p);
+            }
+        }
+        return p;
+    }
+};
+
+const crc32c_tables crc32c_table;
+
+std::uint32_t crc32c_portable(const unsigned char* p, std::size_t n)
+{
+    std::uint32_t c = ~0u;
+    for(std::size_t i = 0; i < n; ++i){
+        c = crc32c_table.bytes[(c ^ p[i]) & 0xff] ^ (c >> 8);
+    }
+    return ~c;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+std::uint32_t crc32c_sse42(const unsigned char* p, std::size_t n)
+{
+    std::uint64_t c = ~0u;
+    for(; n != 0 && reinterpret_cast<std::uintptr_t>(p) % 8 != 0; --n){
+        c = _mm_crc32_u8(static_cast<std::uint32_t>(c), *p++);
+    }
+    for(; n >= 8; n -= 8, p += 8){
+        std::uint64_t w;
+        std::memcpy(&w, p, sizeof(w));
+        c = _mm_crc32_u64(c, w);
+    }
+    for(; n != 0; --n){
+        c = _mm_crc32_u8(static_cast<std::uint32_t>(c), *p++);
+    }
+    return ~static_cast<std::uint32_t>(c);
+}
+
+bool detect_crc32c_instruction()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+
+const bool has_crc32c_instruction = detect_crc32c_instruction();
+#else
+const bool has_crc32c_instruction = false;
+#endif
+
+// a 128-bit integer, which gcc and clang provide on 64-bit targets.
+__extension__ typedef unsigned __int128 uint128;
+
+// hash64 is the polynomial of the bytes plus one, so that leading zeros count,
+// evaluated at a fixed point modulo the mersenne prime 2^61 - 1.
+constexpr std::uint64_t hash64_prime = (std::uint64_t(1) << 61) - 1;
+constexpr std::uint64_t hash64_point = UINT64_C(0x0c3a5e3b9c0f4d71);
+constexpr std::size_t hash64_block = 16;
+
+std::uint64_t reduce(uint128 x)
+{
+    std::uint64_t r = static_cast<std::uint64_t>(x & hash64_prime)
+        + static_cast<std::uint64_t>(x >> 61);
+    r = (r & hash64_prime) + (r >> 61);
+    return r >= hash64_prime ? r - hash64_prime : r;
+}
+
+std::uint64_t multiply(std::uint64_t a, std::uint64_t b)
+{
+    return reduce(static_cast<uint128>(a) * b);
+}
+
+std::uint64_t power(std::uint64_t x, std::size_t n)
+{
+    std::uint64_t p = 1;
+    for(; n != 0; n >>= 1, x = multiply(x, x)){
+        if(n & 1){
+            p = multiply(p, x);
+        }
+    }
+    return p;
+}
+
+struct hash64_powers{
+    // powers[i] is hash64_point^i.
+    std::uint64_t powers[hash64_block + 1];
+
+    hash64_powers()
+    {
+        powers[0] = 1;
+        for(std::size_t i = 1; i <= hash64_block; ++i){
+            powers[i] = multiply(powers[i - 1], hash64_point);
+        }
+    }
+};
+
+const hash64_powers hash64_table;
+
+std::uint64_t hash64(const unsigned char* p, std::size_t n)
+{
+    std::uint64_t h = 0;
+    // a block costs one reduction, as the sum of the products of the bytes fits in 128 bits.
+    for(; n >= hash64_block; n -= hash64_block, p += hash64_block){
+        uint128 sum = static_cast<uint128>(h) * hash64_table.powers[hash64_block];
+        for(std::size_t i = 0; i < hash64_block; ++i){
+            sum += static_cast<uint128>(p[i] + 1u)
+                * hash64_table.powers[hash64_block - 1 - i];
+        }
+        h = reduce(sum);
+    }
+    for(; n != 0; --n){
+        h = reduce(static_cast<uint128>(h) * hash64_point + (*p++ + 1u));
+    }
+    return h;
+}
+
+}
+
+checksum::checksum(checksum_algorithm algorithm):
+    algorithm_(algorithm), value_(0)
+{
+    if(algorithm_ == checksum_algorithm::AUTO){
+        algorithm_ = has_crc32c_instruction ? checksum_algorithm::CRC32C
+            : checksum_algorithm::HASH64;
+    }
+}
+
+const char* checksum::name()const
+{
+    switch(algorithm_){
+    case checksum_algorithm::CRC32C: return "crc32c";
+    case checksum_algorithm::HASH64: return "hash64";
+    default:                         return "none";
+    }
+}
+
+std::uint64_t checksum::compute(const void* data, std::size_t n)const
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    switch(algorithm_){
+    case checksum_algorithm::CRC32C:
+#if defined(__x86_64__)
+        if(has_crc32c_instruction){
+            return crc32c_sse42(p, n);
+        }
+#endif
+        return crc32c_portable(p, n);
+    case checksum_algorithm::HASH64:
+        return hash64(p, n);
+    default:
+        return 0;
+    }
+}
+
+void checksum::append(std::uint64_t digest, std::size_t n)
+{
+    switch(algorithm_){
+    case checksum_algorithm::CRC32C:
+        value_ = crc32c_tables::multiply(crc32c_table.shift(n), static_cast<std::uint32_t>(value_))
+            ^ digest;
+        break;
+    case checksum_algorithm::HASH64:
+        value_ = reduce(static_cast<uint128>(value_) * power(hash64_point, n) + digest);
+        break;
+    default:
+        break;
+    }
+}
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
@@ -0,0 +1,44 @@
+#ifndef CHECKSUM_HPP_
+#define CHECKSUM_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum class checksum_algorithm{
+    NONE,
+    // crc32c if the cpu has an instruction for it, hash64 otherwise.
+    AUTO,
+    CRC32C,
+    // a polynomial hash modulo 2^61 - 1.
+    HASH64,
+};
+
+checksum_algorithm to_checksum_algorithm(const std::string& str);
+
+// the checksum of a sequence of bytes, which can be computed piece by piece, on as many
+// threads as the pieces, and combined in the order of the pieces afterwards.
+class checksum{
+public:
+    // AUTO is resolved here.
+    explicit checksum(checksum_algorithm algorithm);
+
+    checksum_algorithm algorithm()const{return algorithm_;}
+    const char* name()const;
+    std::uint64_t value()const{return value_;}
+    void reset(){value_ = 0;}
+
+    // the checksum of n bytes from 'data' alone.
+    std::uint64_t compute(const void* data, std::size_t n)const;
+    // appends n bytes, whose checksum is 'digest', to the ones so far.
+    void append(std::uint64_t digest, std::size_t n);
+    void update(const void* data, std::size_t n){append(compute(data, n), n);}
+
+private:
+    checksum_algorithm algorithm_;
+    std::uint64_t value_;
+};
+
+#endif // CHECKSUM_HPP_
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
@@ -1,13 +1,19 @@
 #ifndef COMMON_HPP_
 #define COMMON_HPP_
 
+#include <cstddef>
 #include <memory>
+#include <string>
 #include <vector>
 #include "fwd.hpp"
+#include "mapping.hpp"
 
 struct transfer{
     std::shared_ptr<target> src;
+    // null with --search, where a transfer is a SRC alone, which is searched.
     std::shared_ptr<target> dst;
+    // SRC "=" DST, which compares them instead.
+    bool compare = false;
 };
 
 struct param{
@@ -18,8 +24,29 @@ struct param{
         endianness(),
         scheduling_policy(),
         jobs(1),
+        auto_jobs(),
+        cpus(),
+        numa_node(-1),
+        kernel(),
+        nontemporal_threshold(),
+        buffer_size(),
+        engine(),
+        queue_depth(32),
+        block_size(1ul << 20),
+        chunk_size(),
+        sync(),
+        max_mismatches(16),
+        checksum(),
+        search(),
+        mapping(),
+        device("/dev/mem"),
         repeat(1),
-        transfers(){}
+        latency(),
+        concurrent(),
+        serve(),
+        connect(),
+        transfers(),
+        specs(){}
 
     bool verbose;
     int width;
@@ -27,8 +54,37 @@ struct param{
     endian endianness;
     int scheduling_policy;
     int jobs;
+    // -j auto. 'jobs' is the most, and copies take as many as pay off.
+    bool auto_jobs;
+    std::vector<int> cpus;
+    int numa_node;
+    copy_kernel kernel;
+    std::size_t nontemporal_threshold;
+    std::size_t buffer_size;
+    io_engine engine;
+    unsigned queue_depth;
+    std::size_t block_size;
+    // 0 lets the size depend on the length and --jobs.
+    std::size_t chunk_size;
+    sync_mode sync;
+    // the differing words reported by SRC "=" DST.
+    std::size_t max_mismatches;
+    // computed over the data of each transfer as it's moved, and reported to stderr.
+    checksum_algorithm checksum;
+    // the needle to look for in SRCs, instead of transferring them.
+    std::string search;
+    mapping_policy mapping;
+    std::string device;
     int repeat;
+    bool latency;
+    // run the transfers which don't conflict with each other at once.
+    bool concurrent;
+    // the socket to serve transfers on, or to send them to.
+    std::string serve;
+    std::string connect;
     std::vector<transfer> transfers;
+    // TRANSFERS as given. with --connect, these are sent to the server instead.
+    std::vector<std::string> specs;
 };
 
 #endif // COMMON_HPP_
@@ -0,0 +1,329 @@
+#include "copykernel.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include "misc.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+copy_kernel to_copy_kernel(const std::string& str)
+{
+    if(str == "auto"){
+        return copy_kernel::AUTO;
+    }else if(str == "portable"){
+        return copy_kernel::PORTABLE;
+    }else if(str == "sse2"){
+        return copy_kernel::SSE2;
+    }else if(str == "avx2"){
+        return copy_kernel::AVX2;
+    }else if(str == "avx512"){
+        return copy_kernel::AVX512;
+    }else{
+        errno = EINVAL;
+        ERROR_THROW("invalid copy kernel");
+    }
+}
+
+static void copy_portable(void* dest, const void* src, std::size_t n, bool)
+{
+    std::memcpy(dest, src, n);
+}
+
+#if defined(__x86_64__)
+
+// the head is copied until dest gets aligned to 'align' bytes.
+static std::size_t head_length(const void* dest, std::size_t n, std::size_t align)
+{
+    const std::size_t misalignment = reinterpret_cast<std::uintptr_t>(dest) & (align - 1);
+    return std::min(n, (align - misalignment) & (align - 1));
+}
+
+static void copy_sse2(void* dest, const void* src, std::size_t n, bool nontemporal)
+{
+    char* d = reinterpret_cast<char*>(dest);
+    const char* s = reinterpret_cast<const char*>(src);
+
+    const std::size_t head = head_length(d, n, 16);
+    std::memcpy(d, s, head);
+    d += head; s += head; n -= head;
+
+    const bool aligned = (reinterpret_cast<std::uintptr_t>(s) & 0xf) == 0;
+    for(; 64 <= n; d += 64, s += 64, n -= 64){
+        const __m128i* sv = static_cast<const __m128i*>(static_cast<const void*>(s));
+        __m128i* dv = static_cast<__m128i*>(static_cast<void*>(d));
+        __m128i x0, x1, x2, x3;
+        if(aligned){
+            x0 = _mm_load_si128(sv + 0); x1 = _mm_load_si128(sv + 1);
+            x2 = _mm_load_si128(sv + 2); x3 = _mm_load_si128(sv + 3);
+        }else{
+            x0 = _mm_loadu_si128(sv + 0); x1 = _mm_loadu_si128(sv + 1);
+            x2 = _mm_loadu_si128(sv + 2); x3 = _mm_loadu_si128(sv + 3);
+        }
+        if(nontemporal){
+            _mm_stream_si128(dv + 0, x0); _mm_stream_si128(dv + 1, x1);
+            _mm_stream_si128(dv + 2, x2); _mm_stream_si128(dv + 3, x3);
+        }else{
+            _mm_store_si128(dv + 0, x0); _mm_store_si128(dv + 1, x1);
+            _mm_store_si128(dv + 2, x2); _mm_store_si128(dv + 3, x3);
+        }
+    }
+    if(nontemporal){
+        _mm_sfence();
+    }
+
+    std::memcpy(d, s, n);
+}
+
+__attribute__((target("avx2")))
+static void copy_avx2(void* dest, const void* src, std::size_t n, bool nontemporal)
+{
+    char* d = reinterpret_cast<char*>(dest);
+    const char* s = reinterpret_cast<const char*>(src);
+
+    const std::size_t head = head_length(d, n, 32);
+    std::memcpy(d, s, head);
+    d += head; s += head; n -= head;
+
+    const bool aligned = (reinterpret_cast<std::uintptr_t>(s) & 0x1f) == 0;
+    for(; 128 <= n; d += 128, s += 128, n -= 128){
+        const __m256i* sv = static_cast<const __m256i*>(static_cast<const void*>(s));
+        __m256i* dv = static_cast<__m256i*>(static_cast<void*>(d));
+        __m256i y0, y1, y2, y3;
+        if(aligned){
+            y0 = _mm256_load_si256(sv + 0); y1 = _mm256_load_si256(sv + 1);
+            y2 = _mm256_load_si256(sv + 2); y3 = _mm256_load_si256(sv + 3);
+        }else{
+            y0 = _mm256_loadu_si256(sv + 0); y1 = _mm256_loadu_si256(sv + 1);
+            y2 = _mm256_loadu_si256(sv + 2); y3 = _mm256_loadu_si256(sv + 3);
+        }
+        if(nontemporal){
+            _mm256_stream_si256(dv + 0, y0); _mm256_stream_si256(dv + 1, y1);
+            _mm256_stream_si256(dv + 2, y2); _mm256_stream_si256(dv + 3, y3);
+        }else{
+            _mm256_store_si256(dv + 0, y0); _mm256_store_si256(dv + 1, y1);
+            _mm256_store_si256(dv + 2, y2); _mm256_store_si256(dv + 3, y3);
+        }
+    }
+    if(nontemporal){
+        _mm_sfence();
+    }
+
+    std::memcpy(d, s, n);
+}
+
+__attribute__((target("avx512f")))
+static void copy_avx512(void* dest, const void* src, std::size_t n, bool nontemporal)
+{
+    char* d = reinterpret_cast<char*>(dest);
+    const char* s = reinterpret_cast<const char*>(src);
+
+    const std::size_t head = head_length(d, n, 64);
+    std::memcpy(d, s, head);
+    d += head; s += head; n -= head;
+
+    const bool aligned = (reinterpret_cast<std::uintptr_t>(s) & 0x3f) == 0;
+    for(; 256 <= n; d += 256, s += 256, n -= 256){
+        const __m512i* sv = static_cast<const __m512i*>(static_cast<const void*>(s));
+        __m512i* dv = static_cast<__m512i*>(static_cast<void*>(d));
+        __m512i z0, z1, z2, z3;
+        if(aligned){
+            z0 = _mm512_load_si512(sv + 0); z1 = _mm512_load_si512(sv + 1);
+            z2 = _mm512_load_si512(sv + 2); z3 = _mm512_load_si512(sv + 3);
+        }else{
+            z0 = _mm512_loadu_si512(sv + 0); z1 = _mm512_loadu_si512(sv + 1);
+            z2 = _mm512_loadu_si512(sv + 2); z3 = _mm512_loadu_si512(sv + 3);
+        }
+        if(nontemporal){
+            _mm512_stream_si512(dv + 0, z0); _mm512_stream_si512(dv + 1, z1);
+            _mm512_stream_si512(dv + 2, z2); _mm512_stream_si512(dv + 3, z3);
+        }else{
+            _mm512_store_si512(dv + 0, z0); _mm512_store_si512(dv + 1, z1);
+            _mm512_store_si512(dv + 2, z2); _mm512_store_si512(dv + 3, z3);
+        }
+    }
+    if(nontemporal){
+        _mm_sfence();
+    }
+
+    std::memcpy(d, s, n);
+}
+
+#endif
+
+static copy_function widest_copy_kernel()
+{
+#if defined(__x86_64__)
+    if(is_supported(copy_kernel::AVX512)){
+        return copy_avx512;
+    }
+    if(is_supported(copy_kernel::AVX2)){
+        return copy_avx2;
+    }
+    return copy_sse2;
+#else
+    return copy_portable;
+#endif
+}
+
+static void copy_auto(void* dest, const void* src, std::size_t n, bool nontemporal)
+{
+    static const copy_function widest = widest_copy_kernel();
+
+    // glibc's memcpy is hard to beat as long as the data stays in the cache.
+    if(nontemporal){
+        widest(dest, src, n, true);
+    }else{
+        std::memcpy(dest, src, n);
+    }
+}
+
+bool is_supported(copy_kernel kernel)
+{
+    switch(kernel){
+    case copy_kernel::AUTO:
+    case copy_kernel::PORTABLE:
+        return true;
+#if defined(__x86_64__)
+    case copy_kernel::SSE2:   return __builtin_cpu_supports("sse2");
+    case copy_kernel::AVX2:   return __builtin_cpu_supports("avx2");
+    case copy_kernel::AVX512: return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return false;
+    }
+}
+
+copy_function select_copy_kernel(copy_kernel kernel)
+{
+    if(!is_supported(kernel)){
+        errno = ENOTSUP;
+        ERROR_THROW("copy kernel not supported by this cpu");
+    }
+
+    switch(kernel){
+    case copy_kernel::AUTO:     return copy_auto;
+    case copy_kernel::PORTABLE: return copy_portable;
+#if defined(__x86_64__)
+    case copy_kernel::SSE2:     return copy_sse2;
+    case copy_kernel::AVX2:     return copy_avx2;
+    case copy_kernel::AVX512:   return copy_avx512;
+#endif
+    default:
+        errno = EINVAL;
+        ERROR_THROW("invalid copy kernel");
+    }
+}
+
+static std::size_t compare_portable(const void* a, const void* b, std::size_t n)
+{
+    const char* x = reinterpret_cast<const char*>(a);
+    const char* y = reinterpret_cast<const char*>(b);
+
+    // memcmp tells which block differs, and only that one is looked into byte by byte.
+    std::size_t i = 0;
+    while(i + 64 <= n && std::memcmp(x + i, y + i, 64) == 0){
+        i += 64;
+    }
+    for(; i < n; ++i){
+        if(x[i] != y[i]){
+            return i;
+        }
+    }
+    return n;
+}
+
+#if defined(__x86_64__)
+
+static std::size_t compare_sse2(const void* a, const void* b, std::size_t n)
+{
+    const char* x = reinterpret_cast<const char*>(a);
+    const char* y = reinterpret_cast<const char*>(b);
+
+    std::size_t i = 0;
+    for(; i + 64 <= n; i += 64){
+        const __m128i* xv = static_cast<const __m128i*>(static_cast<const void*>(x + i));
+        const __m128i* yv = static_cast<const __m128i*>(static_cast<const void*>(y + i));
+        // a bit per byte, which is set if the bytes are equal.
+        std::uint64_t equal = 0;
+        for(int j = 0; j < 4; ++j){
+            const std::uint64_t m = static_cast<std::uint16_t>(_mm_movemask_epi8(
+                        _mm_cmpeq_epi8(_mm_loadu_si128(xv + j), _mm_loadu_si128(yv + j))));
+            equal |= m << (16 * j);
+        }
+        if(equal != UINT64_MAX){
+            return i + static_cast<std::size_t>(__builtin_ctzll(~equal));
+        }
+    }
+    return i + compare_portable(x + i, y + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static std::size_t compare_avx2(const void* a, const void* b, std::size_t n)
+{
+    const char* x = reinterpret_cast<const char*>(a);
+    const char* y = reinterpret_cast<const char*>(b);
+
+    std::size_t i = 0;
+    for(; i + 64 <= n; i += 64){
+        const __m256i* xv = static_cast<const __m256i*>(static_cast<const void*>(x + i));
+        const __m256i* yv = static_cast<const __m256i*>(static_cast<const void*>(y + i));
+        const std::uint64_t lo = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+                    _mm256_cmpeq_epi8(_mm256_loadu_si256(xv + 0), _mm256_loadu_si256(yv + 0))));
+        const std::uint64_t hi = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+                    _mm256_cmpeq_epi8(_mm256_loadu_si256(xv + 1), _mm256_loadu_si256(yv + 1))));
+        const std::uint64_t equal = lo | hi << 32;
+        if(equal != UINT64_MAX){
+            return i + static_cast<std::size_t>(__builtin_ctzll(~equal));
+        }
+    }
+    return i + compare_portable(x + i, y + i, n - i);
+}
+
+#endif
+
+compare_function select_compare_kernel(copy_kernel kernel)
+{
+    if(!is_supported(kernel)){
+        errno = ENOTSUP;
+        ERROR_THROW("copy kernel not supported by this cpu");
+    }
+
+    switch(kernel){
+    case copy_kernel::PORTABLE: return compare_portable;
+#if defined(__x86_64__)
+    case copy_kernel::AUTO:
+        return is_supported(copy_kernel::AVX2) ? compare_avx2 : compare_sse2;
+    case copy_kernel::SSE2:     return compare_sse2;
+    // comparing is bound by the loads, which avx-512 makes no faster than avx2.
+    case copy_kernel::AVX2:
+    case copy_kernel::AVX512:   return compare_avx2;
+#else
+    case copy_kernel::AUTO:     return compare_portable;
+#endif
+    default:
+        errno = EINVAL;
+        ERROR_THROW("invalid copy kernel");
+    }
+}
+
+std::size_t effective_nontemporal_threshold(std::size_t threshold)
+{
+    if(0 < threshold){
+        return threshold;
+    }
+
+    static const std::size_t llc_size = [](){
+        long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        if(size <= 0){
+            size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        }
+        return 0 < size ? static_cast<std::size_t>(size) : std::size_t(8) << 20;
+    }();
+    return llc_size;
+}
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
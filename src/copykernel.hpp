@@ -0,0 +1,42 @@
+#ifndef COPYKERNEL_HPP_
+#define COPYKERNEL_HPP_
+
+#include <cstddef>
+#include <string>
+#include "fwd.hpp"
+
+enum class copy_kernel{
+    AUTO,
+    PORTABLE,
+    SSE2,
+    AVX2,
+    AVX512,
+};
+
+copy_kernel to_copy_kernel(const std::string& str);
+
+// copies n bytes from src to dest. if nontemporal is true, dest is written
+// with streaming stores which bypass the cache hierarchy.
+using copy_function = void (*)(void* dest, const void* src, std::size_t n, bool nontemporal);
+
+bool is_supported(copy_kernel kernel);
+
+// copy_kernel::AUTO copies with glibc's memcpy, which is hard to beat while the data
+// stays in the cache, and with the widest kernel the running cpu supports for
+// non-temporal copies. throws if the kernel is not supported by the running cpu.
+copy_function select_copy_kernel(copy_kernel kernel);
+
+// returns the position of the first byte which differs between a and b, or n if none.
+using compare_function = std::size_t (*)(const void* a, const void* b, std::size_t n);
+
+// resolves copy_kernel::AUTO to the widest kernel the running cpu supports, for comparing.
+// throws in the same way as select_copy_kernel().
+compare_function select_compare_kernel(copy_kernel kernel);
+
+// copies larger than this go through non-temporal stores.
+// 'threshold' of 0 stands for the size of the last level cache.
+std::size_t effective_nontemporal_threshold(std::size_t threshold);
+
+#endif // COPYKERNEL_HPP_
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
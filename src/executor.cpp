@@ -0,0 +1,149 @@
+#include "executor.hpp"
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unistd.h>
+#include "autotune.hpp"
+#include "common.hpp"
+#include "misc.hpp"
+#include "target.hpp"
+#include "workerpool.hpp"
+
+executor::executor(const param& prm)
+: prm_(prm),
+plan_(),
+dependencies_(prm.transfers.size())
+{
+    // measured here, if it has to be, rather than in the first transfer timed.
+    if(prm_.auto_jobs){
+        calibration::get(prm_);
+    }
+
+    const std::vector<transfer>& transfers = prm_.transfers;
+    // searches and comparisons write their results to stdout, which is opened already.
+    // it's looked at only if there are any of them, so that it may be closed otherwise.
+    std::optional<target> out;
+    if(std::any_of(transfers.begin(), transfers.end(), writes_results)){
+        out.emplace(STDOUT_FILENO);
+    }
+    for(std::size_t i = 0; i < transfers.size(); ++i){
+        const transfer& t = transfers[i];
+        if(!t.dst){
+            plan_.push_back(t.src->compile_search(prm_, STDOUT_FILENO));
+        }else if(t.compare){
+            plan_.push_back(t.src->compile_compare(*t.dst, prm_, STDOUT_FILENO));
+        }else{
+            plan_.push_back(t.src->compile(*t.dst, prm_));
+        }
+        for(std::size_t j = 0; j < i; ++j){
+            if(conflicts(transfers[j], transfers[i], out ? &*out : nullptr)){
+                dependencies_[i].push_back(j);
+            }
+        }
+    }
+}
+
+std::size_t executor::run_all()const
+{
+    enum class state{PENDING, DONE, FAILED};
+
+    const std::size_t count = plan_.size();
+    std::vector<state> states(count, state::PENDING);
+    std::vector<std::string> errors(count);
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    // tasks are started in the order of their indices, so that the ones waited for
+    // have been taken by the other threads already, and never starve.
+    worker_pool::instance(prm_.scheduling_policy, static_cast<std::size_t>(prm_.jobs), prm_.cpus).run(
+            count, static_cast<std::size_t>(prm_.jobs), [&](std::size_t i){
+        bool skipped = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for(const std::size_t j: dependencies_[i]){
+                finished.wait(lock, [&]{return states[j] != state::PENDING;});
+                if(states[j] == state::FAILED){
+                    skipped = true;
+                    errors[i] = "skipped, as transfer " + std::to_string(j) + " has failed";
+                }
+            }
+        }
+
+        std::string error;
+        if(!skipped){
+            try{
+                const int ret = plan_[i]();
+                if(ret == target::differ){
+                    error = "differ";
+                }else if(ret == target::not_found){
+                    error = "not found";
+                }else if(ret != 0){
+                    error = std::strerror(ret);
+                }
+            }catch(const std::exception& e){
+                error = e.what();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!skipped){
+                errors[i] = error;
+            }
+            states[i] = errors[i].empty() ? state::DONE : state::FAILED;
+        }
+        finished.notify_all();
+    });
+
+    std::size_t failures = 0;
+    for(std::size_t i = 0; i < count; ++i){
+        if(states[i] == state::FAILED){
+            ++failures;
+            std::cerr << progname << ": transfer " << i;
+            if(i < prm_.specs.size()){
+                std::cerr << " (" << prm_.specs[i] << ')';
+            }
+            std::cerr << ": " << errors[i] << std::endl;
+        }
+    }
+    return failures;
+}
+
+bool executor::writes_results(const transfer& t)
+{
+    return !t.dst || t.compare;
+}
+
+bool executor::conflicts(const transfer& earlier, const transfer& later, const target* out)
+{
+    // the targets each of them touches, and whether it writes them.
+    // both sides of a comparison are only read, as is a SRC searched, which has no dst.
+    // both of them write their results to 'out' instead, in the order of the transfers.
+    using access = std::pair<const target*, bool>;
+    const auto accesses = [out](const transfer& t){
+        return std::array<access, 3>{{access(t.src.get(), false), access(t.dst.get(), !t.compare),
+            access(writes_results(t) ? out : nullptr, true)}};
+    };
+
+    // reading a stream consumes it, as writing does.
+    for(const auto& [a, a_writes]: accesses(earlier)){
+        for(const auto& [b, b_writes]: accesses(later)){
+            if(!a || !b){
+                continue;
+            }
+            const bool exclusive = a_writes || b_writes || !a->is_mapped() || !b->is_mapped();
+            if(exclusive && a->overlaps(*b)){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
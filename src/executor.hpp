@@ -0,0 +1,46 @@
+#ifndef EXECUTOR_HPP_
+#define EXECUTOR_HPP_
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include "fwd.hpp"
+
+// runs the transfers of a param, compiled once.
+// run_all() runs them at once on the worker threads, except that a transfer waits for
+// the earlier ones it conflicts with, so that the result is the same as in order.
+class executor{
+public:
+    // compiles the transfers of 'prm', which has to outlive this.
+    explicit executor(const param& prm);
+    executor(const executor&) = delete;
+    executor& operator=(const executor&) = delete;
+
+    std::size_t size()const{return plan_.size();}
+    // the earlier transfers which the i-th one waits for.
+    const std::vector<std::size_t>& dependencies(std::size_t i)const{return dependencies_.at(i);}
+
+    // runs the i-th transfer, in the same way as transfer_to().
+    int run(std::size_t i)const{return plan_.at(i)();}
+    // runs all of them, each as soon as the ones it depends on have finished.
+    // the ones depending on a failed one are skipped. after all of them have
+    // finished, the failures are reported to stderr in the order of the transfers.
+    // returns the number of the transfers failed or skipped.
+    std::size_t run_all()const;
+
+private:
+    // whether 't' is a search or a comparison, which writes its results to stdout.
+    static bool writes_results(const transfer& t);
+    // whether 'later' has to wait for 'earlier', i.e. either writes what the other
+    // reads or writes, or both read the same stream. 'out' is stdout, which the results
+    // are written to, or null if neither writes any.
+    static bool conflicts(const transfer& earlier, const transfer& later, const target* out);
+
+    const param& prm_;
+    std::vector<std::function<int()>> plan_;
+    std::vector<std::vector<std::size_t>> dependencies_;
+};
+
+#endif // EXECUTOR_HPP_
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
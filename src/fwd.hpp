@@ -2,8 +2,16 @@
 #define FWD_HPP_
 
 class target;
+class device_cache;
+class checksum;
+class pattern;
+class needle;
 enum class target_role;
 enum class endian;
+enum class sync_mode;
+enum class copy_kernel;
+enum class io_engine;
+enum class checksum_algorithm;
 
 struct transfer;
 struct param;
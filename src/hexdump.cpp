@@ -0,0 +1,284 @@
+#include "hexdump.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "misc.hpp"
+#include "target.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace{
+
+struct conversion_table{
+    constexpr conversion_table(): hex(), printable()
+    {
+        constexpr char digits[] = "0123456789abcdef";
+        for(int b = 0; b < 0x100; ++b){
+            hex[b][0] = digits[b >> 4];
+            hex[b][1] = digits[b & 0xf];
+            // same as std::isprint() in the "C" locale.
+            printable[b] = 0x20 <= b && b < 0x7f ? static_cast<char>(b) : '.';
+        }
+    }
+
+    char hex[0x100][2];
+    char printable[0x100];
+};
+
+constexpr conversion_table table;
+
+inline unsigned char byte_at(const char* p, std::size_t i)
+{
+    return static_cast<unsigned char>(p[i]);
+}
+
+inline char* put_heading(char* out, std::size_t heading)
+{
+    for(int shift = (sizeof(std::size_t) - 1) * 8; 0 <= shift; shift -= 8){
+        const char* hex = table.hex[(heading >> shift) & 0xff];
+        *out++ = hex[0];
+        *out++ = hex[1];
+    }
+    return out;
+}
+
+// converts 16 bytes to 32 hexadecimal digits, in memory order.
+inline void to_hex(char* hex, const char* line)
+{
+#if defined(__SSE2__)
+    const __m128i v = _mm_loadu_si128(static_cast<const __m128i*>(static_cast<const void*>(line)));
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+    const __m128i lo = _mm_and_si128(v, nibble);
+
+    const auto to_digits = [](__m128i x){
+        const __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(9)),
+                _mm_set1_epi8('a' - '0' - 10));
+        return _mm_add_epi8(_mm_add_epi8(x, _mm_set1_epi8('0')), alpha);
+    };
+    _mm_storeu_si128(static_cast<__m128i*>(static_cast<void*>(hex)),      to_digits(_mm_unpacklo_epi8(hi, lo)));
+    _mm_storeu_si128(static_cast<__m128i*>(static_cast<void*>(hex + 16)), to_digits(_mm_unpackhi_epi8(hi, lo)));
+#else
+    for(std::size_t i = 0; i < 16; ++i){
+        std::memcpy(hex + 2 * i, table.hex[byte_at(line, i)], 2);
+    }
+#endif
+}
+
+inline void to_ascii(char* out, const char* line)
+{
+#if defined(__SSE2__)
+    const __m128i v = _mm_loadu_si128(static_cast<const __m128i*>(static_cast<const void*>(line)));
+    // bytes of 0x80 or more are negative, thus not printable either.
+    const __m128i printable = _mm_and_si128(
+            _mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)), _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+    _mm_storeu_si128(static_cast<__m128i*>(static_cast<void*>(out)), _mm_or_si128(
+                _mm_and_si128(printable, v), _mm_andnot_si128(printable, _mm_set1_epi8('.'))));
+#else
+    for(std::size_t i = 0; i < 16; ++i){
+        out[i] = table.printable[byte_at(line, i)];
+    }
+#endif
+}
+
+// whether the most significant byte of a word, which is printed first,
+// is the last one in memory.
+constexpr bool is_reversed(int width, endian e)
+{
+    if(width == 8){
+        return false;
+    }
+    switch(e){
+    case endian::BIG:    return false;
+    case endian::LITTLE: return true;
+    case endian::HOST:
+    default:             return __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+    }
+}
+
+template <int Width, endian E>
+char* format_full_line(char* out, const char* line, std::size_t heading)
+{
+    constexpr std::size_t bytewise_width = Width / 8;
+    constexpr bool reversed = is_reversed(Width, E);
+
+    out = put_heading(out, heading);
+
+    char hex[32];
+    to_hex(hex, line);
+    for(std::size_t w = 0; w < 16; w += bytewise_width){
+        if((w & 0x3) == 0){
+            *out++ = ' ';
+        }
+        for(std::size_t j = 0; j < bytewise_width; ++j){
+            const std::size_t b = reversed ? w + bytewise_width - 1 - j : w + j;
+            *out++ = hex[2 * b];
+            *out++ = hex[2 * b + 1];
+        }
+    }
+
+    *out++ = ' ';
+    *out++ = '>';
+    to_ascii(out, line);
+    out += 16;
+    *out++ = '<';
+    *out++ = '\n';
+    return out;
+}
+
+} // namespace
+
+hexdump_formatter::hexdump_formatter(const char* data, std::size_t offset, std::size_t length,
+        std::size_t page_offset, int width, endian e)
+: data_(data),
+origin_(),
+offset_(offset),
+page_offset_(page_offset),
+end_(page_offset + length),
+width_(static_cast<std::size_t>(width)),
+bytewise_width_(width_ / 8),
+first_byte_(page_offset & ~0xful),
+lines_((end_ - first_byte_ + 0xf) / 0x10),
+full_line_(select_line_function(width, e)),
+reversed_(is_reversed(width, e))
+{}
+
+std::size_t hexdump_formatter::line_at(std::size_t i)const
+{
+    if(i <= first_byte_){
+        return 0;
+    }
+    return std::min(lines_, (i - first_byte_ + 0xf) / 0x10);
+}
+
+std::size_t hexdump_formatter::region_at(std::size_t line)const
+{
+    return std::min(end_, std::max(page_offset_, first_byte_ + line * 0x10));
+}
+
+std::size_t hexdump_formatter::header(char* out)const
+{
+    const char* sp = width_ < 64 ? " " : "";
+    const char* dash = width_ < 64 ? "-" : "";
+    const int ret = std::snprintf(out, max_header_size,
+    "Offset%*s ""0       %s4        8       %sc         ASCII\n"
+    "%.*s "     "--------%s-----------------%s--------  ----------------\n",
+    static_cast<int>(2 * sizeof(std::size_t) - 6), "", sp, sp,
+    static_cast<int>(2 * sizeof(std::size_t)), "----------------", dash, dash);
+    if(ret < 0){
+        ERROR_THROW("std::snprintf");
+    }
+    return static_cast<std::size_t>(ret);
+}
+
+std::size_t hexdump_formatter::format(char* out, std::size_t first_line, std::size_t last_line)const
+{
+    char* const begin = out;
+    for(std::size_t line = first_line; line < last_line; ++line){
+        const std::size_t i = first_byte_ + line * 0x10;
+        if(page_offset_ <= i && i + 0x10 <= end_){
+            out = full_line_(out, at(i), (offset_ & ~0xful) + line * 0x10);
+        }else{
+            out = format_partial_line(out, line);
+        }
+    }
+    return static_cast<std::size_t>(out - begin);
+}
+
+// formats a line which is not entirely in the region, namely the first one
+// and the last one, in exactly the same way as the original printf based loop did.
+char* hexdump_formatter::format_partial_line(char* out, std::size_t line)const
+{
+    const std::size_t first = first_byte_ + line * 0x10;
+    const std::size_t bytewise_width = bytewise_width_;
+
+    out = put_heading(out, (offset_ & ~0xful) + line * 0x10);
+
+    // this contains space not only for termination character '\0',
+    // but also for preceeding character '>'.
+    char ascii[0x10 + 2] = {'>'};
+
+    for(std::size_t i = first; i < end_ && i < first + 0x10; i += bytewise_width){
+        if((i & 0x3) == 0x0){
+            *out++ = ' ';
+        }
+
+        if(i < page_offset_){
+            out = std::fill_n(out, 2 * bytewise_width, ' ');
+            // same as std::snprintf(ascii, sizeof(ascii), "%*s>", w, "").
+            const std::size_t w = (i + bytewise_width) & ~(bytewise_width - 1);
+            if(w + 1 < sizeof(ascii)){
+                std::memset(ascii, ' ', w);
+                ascii[w] = '>';
+                ascii[w + 1] = '\0';
+            }else{
+                std::memset(ascii, ' ', sizeof(ascii) - 1);
+                ascii[sizeof(ascii) - 1] = '\0';
+            }
+        }else{
+            for(std::size_t j = 0; j < bytewise_width; ++j){
+                const std::size_t b = reversed_ ? i + bytewise_width - 1 - j : i + j;
+                *out++ = table.hex[byte_at(at(b), 0)][0];
+                *out++ = table.hex[byte_at(at(b), 0)][1];
+            }
+            for(std::size_t j = 0; j < bytewise_width; ++j){
+                ascii[((i + j) & 0xful) + 1] = table.printable[byte_at(at(i + j), 0)];
+            }
+        }
+
+        if(((i + bytewise_width) & 0xful) == 0x0){
+            *out++ = ' ';
+            out = std::copy_n(ascii, std::strlen(ascii), out);
+            *out++ = '<';
+            *out++ = '\n';
+            std::memset(ascii, '\0', sizeof(ascii));
+            ascii[0] = '>';
+        }
+    }
+
+    if(line + 1 < lines_){
+        return out;
+    }
+
+    const std::size_t padding_for_hex = (0xful
+            - (((end_ - 1 + bytewise_width) & ~(bytewise_width - 1)) & 0xful)
+            + 1) & 0xful;
+    const std::size_t padding_for_sep = ((~(end_ - 1)) >> 2 & 0x3);
+    out = std::fill_n(out, 2 * padding_for_hex + padding_for_sep, ' ');
+
+    if(ascii[1]){
+        *out++ = ' ';
+        out = std::copy_n(ascii, std::strlen(ascii), out);
+        *out++ = '<';
+        *out++ = '\n';
+    }
+    return out;
+}
+
+hexdump_formatter::line_function hexdump_formatter::select_line_function(int width, endian e)
+{
+#define LINE_FUNCTION(w) \
+    case w: \
+        switch(e){ \
+        case endian::BIG:    return format_full_line<w, endian::BIG>; \
+        case endian::LITTLE: return format_full_line<w, endian::LITTLE>; \
+        case endian::HOST: \
+        default:             return format_full_line<w, endian::HOST>; \
+        }
+
+    switch(width){
+    LINE_FUNCTION(8)
+    LINE_FUNCTION(16)
+    LINE_FUNCTION(32)
+    LINE_FUNCTION(64)
+    default:
+        errno = EINVAL;
+        ERROR_THROW(std::string("unsupported bit width: ") + std::to_string(width));
+    }
+#undef LINE_FUNCTION
+}
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
@@ -0,0 +1,60 @@
+#ifndef HEXDUMP_HPP_
+#define HEXDUMP_HPP_
+
+#include <cstddef>
+#include "fwd.hpp"
+
+// formats a mapped region in the style of 'masterkey -d'.
+// the output is split into lines of 16 bytes each, so that any range of
+// lines can be formatted independently of the others.
+class hexdump_formatter{
+public:
+    // 'data' points to the beginning of the page that contains 'offset',
+    // and 'page_offset' is the position of 'offset' in that page.
+    hexdump_formatter(const char* data, std::size_t offset, std::size_t length,
+            std::size_t page_offset, int width, endian e);
+
+    // upper bound of the bytes written by header().
+    static constexpr std::size_t max_header_size = 160;
+    // upper bound of the bytes written per line by format().
+    static constexpr std::size_t max_line_size = 80;
+
+    std::size_t lines()const{return lines_;}
+    // the number of lines which start before 'i', the position in the page.
+    std::size_t line_at(std::size_t i)const;
+    // the position in the page of the first byte of 'line' in the region,
+    // or of the end of the region if there is none.
+    std::size_t region_at(std::size_t line)const;
+
+    // lets 'data' point to 'origin', the position in the page, instead,
+    // so that a region can be formatted window by window.
+    void rebase(const char* data, std::size_t origin){data_ = data; origin_ = origin;}
+
+    // both return the number of bytes written to 'out'.
+    std::size_t header(char* out)const;
+    std::size_t format(char* out, std::size_t first_line, std::size_t last_line)const;
+
+private:
+    using line_function = char* (*)(char* out, const char* line, std::size_t heading);
+
+    char* format_partial_line(char* out, std::size_t line)const;
+    const char* at(std::size_t i)const{return data_ + (i - origin_);}
+
+    static line_function select_line_function(int width, endian e);
+
+    const char* data_;
+    std::size_t origin_;
+    const std::size_t offset_;
+    const std::size_t page_offset_;
+    const std::size_t end_;
+    const std::size_t width_;
+    const std::size_t bytewise_width_;
+    const std::size_t first_byte_;
+    const std::size_t lines_;
+    const line_function full_line_;
+    const bool reversed_;
+};
+
+#endif // HEXDUMP_HPP_
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
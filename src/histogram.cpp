@@ -0,0 +1,98 @@
+#include "histogram.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <time.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+const bool tick_clock::invariant_tsc_ = tick_clock::detect_invariant_tsc();
+
+double tick_clock::ticks_per_ns()
+{
+    static const double ratio = [](){
+        if(!invariant_tsc_){
+            return 1.0;
+        }
+        const std::uint64_t ns0 = monotonic_ns();
+        const std::uint64_t t0 = now();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        const std::uint64_t ns1 = monotonic_ns();
+        const std::uint64_t t1 = now();
+        return static_cast<double>(t1 - t0) / static_cast<double>(ns1 - ns0);
+    }();
+    return ratio;
+}
+
+std::uint64_t tick_clock::monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000ul + static_cast<std::uint64_t>(ts.tv_nsec);
+}
+
+bool tick_clock::detect_invariant_tsc()
+{
+#if defined(__x86_64__)
+    // CPUID.80000007H:EDX[8], the tsc runs at a constant rate in all the states.
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8));
+#else
+    return false;
+#endif
+}
+
+latency_histogram::latency_histogram()
+: counts_(),
+count_(),
+min_(UINT64_MAX),
+max_()
+{}
+
+std::uint64_t latency_histogram::percentile(double q)const
+{
+    if(count_ == 0){
+        return 0;
+    }
+
+    const std::uint64_t rank = std::max<std::uint64_t>(1,
+            static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(count_))));
+    std::uint64_t seen = 0;
+    for(std::size_t i = 0; i < buckets; ++i){
+        seen += counts_[i];
+        if(rank <= seen){
+            return std::min(highest_value_of(i), max_);
+        }
+    }
+    return max_;
+}
+
+void latency_histogram::report(std::ostream& os)const
+{
+    const double ratio = tick_clock::ticks_per_ns();
+    const auto ns = [ratio](std::uint64_t ticks){
+        return static_cast<std::uint64_t>(std::llround(static_cast<double>(ticks) / ratio));
+    };
+    os << "latency(ns): count " << count_
+        << " min "   << ns(min())
+        << " p50 "   << ns(percentile(0.5))
+        << " p99 "   << ns(percentile(0.99))
+        << " p99.9 " << ns(percentile(0.999))
+        << " max "   << ns(max()) << std::endl;
+}
+
+std::uint64_t latency_histogram::highest_value_of(std::size_t index)
+{
+    if(index < 2 * half_sub_buckets){
+        return index;
+    }
+    const std::size_t shift = index / half_sub_buckets - 1;
+    const std::uint64_t mantissa = index - shift * half_sub_buckets;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
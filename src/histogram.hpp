@@ -0,0 +1,85 @@
+#ifndef HISTOGRAM_HPP_
+#define HISTOGRAM_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// a monotonic clock cheap enough to be read around each iteration of a loop.
+// it counts the time stamp counter if the cpu keeps it invariant, or nanoseconds otherwise.
+class tick_clock{
+public:
+    static std::uint64_t now()
+    {
+#if defined(__x86_64__)
+        if(invariant_tsc_){
+            return __rdtsc();
+        }
+#endif
+        return monotonic_ns();
+    }
+
+    // the number of ticks per nanosecond, which is measured for 10ms on the first call.
+    static double ticks_per_ns();
+
+private:
+    static std::uint64_t monotonic_ns();
+    static bool detect_invariant_tsc();
+
+    static const bool invariant_tsc_;
+};
+
+// an HDR style histogram of latencies, which holds values from 1 to 2^64 - 1
+// with relative errors less than 1/64, in memory allocated up front.
+class latency_histogram{
+public:
+    latency_histogram();
+
+    void record(std::uint64_t value)
+    {
+        ++counts_[index_of(value)];
+        ++count_;
+        min_ = value < min_ ? value : min_;
+        max_ = max_ < value ? value : max_;
+    }
+
+    std::uint64_t count()const{return count_;}
+    std::uint64_t min()const{return count_ == 0 ? 0 : min_;}
+    std::uint64_t max()const{return max_;}
+    // the least value that 'q' (0.0 to 1.0) of the recorded values are no greater than,
+    // rounded up to the end of its bucket, but no greater than max().
+    std::uint64_t percentile(double q)const;
+
+    // writes count, min, p50, p99, p99.9 and max on a line, as nanoseconds
+    // of values recorded in ticks of tick_clock.
+    void report(std::ostream& os)const;
+
+private:
+    static constexpr unsigned sub_bucket_bits = 7;
+    static constexpr std::size_t half_sub_buckets = std::size_t(1) << (sub_bucket_bits - 1);
+    static constexpr std::size_t buckets =
+        (64 - sub_bucket_bits + 1) * half_sub_buckets + half_sub_buckets;
+
+    // values below 2^sub_bucket_bits have their own buckets. beyond them, each power
+    // of two is split into 'half_sub_buckets' buckets of equal width.
+    static std::size_t index_of(std::uint64_t value)
+    {
+        const unsigned magnitude = 63u - static_cast<unsigned>(__builtin_clzll(value | 1));
+        const unsigned shift = magnitude < sub_bucket_bits ? 0 : magnitude - sub_bucket_bits + 1;
+        return shift * half_sub_buckets + (value >> shift);
+    }
+    static std::uint64_t highest_value_of(std::size_t index);
+
+    std::uint64_t counts_[buckets];
+    std::uint64_t count_;
+    std::uint64_t min_;
+    std::uint64_t max_;
+};
+
+#endif // HISTOGRAM_HPP_
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
@@ -0,0 +1,149 @@
+#include "mapping.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <set>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "misc.hpp"
+#include "stats.hpp"
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+void parse_mapping_policy(const std::string& str, mapping_policy& policy)
+{
+    for(std::size_t pos = 0, end = 0; end < str.size(); pos = end + 1){
+        end = std::min(str.find(',', pos), str.size());
+        const std::string flag = str.substr(pos, end - pos);
+        if(flag == "populate"){
+            policy.populate = true;
+        }else if(flag == "lazy"){
+            policy.populate = false;
+        }else if(flag == "sequential"){
+            policy.sequential = true;
+        }else if(flag == "willneed"){
+            policy.willneed = true;
+        }else if(flag == "hugepage"){
+            policy.hugepage = true;
+        }else{
+            errno = EINVAL;
+            ERROR_THROW("invalid mapping policy: '" + flag + "'");
+        }
+    }
+    if(str.empty() || str.back() == ','){
+        errno = EINVAL;
+        ERROR_THROW("invalid mapping policy: '" + str + "'");
+    }
+}
+
+static void advise(void* addr, std::size_t length, int advice, const char* name,
+        const mapping_policy& policy)
+{
+    // these are only hints. e.g. device memory doesn't take them.
+    stats::add_syscall();
+    if(madvise(addr, length, advice) == -1 && policy.report){
+        WARN(std::string("madvise(") + name + "): " + std::strerror(errno));
+    }
+}
+
+static void advise(void* addr, std::size_t length, bool regular_file,
+        const mapping_policy& policy)
+{
+    if(policy.hugepage && regular_file){
+        advise(addr, length, MADV_HUGEPAGE, "MADV_HUGEPAGE", policy);
+    }
+    if(policy.sequential){
+        advise(addr, length, MADV_SEQUENTIAL, "MADV_SEQUENTIAL", policy);
+    }
+    if(policy.willneed){
+        advise(addr, length, MADV_WILLNEED, "MADV_WILLNEED", policy);
+    }
+}
+
+// the descriptors which have refused MADV_POPULATE_*, e.g. of /dev/mem for any region
+// of more than a page, or all of them before linux 5.14. they are mapped with MAP_POPULATE
+// at once from then on. a number reused for another file does no harm, as it works for any.
+static std::mutex refusing_mutex;
+static std::set<int> refusing_fds;
+
+static bool refuses_populate(int fd)
+{
+    std::lock_guard<std::mutex> lock(refusing_mutex);
+    return refusing_fds.count(fd) != 0;
+}
+
+static void* map_populated(int fd, std::size_t length, int prot, off_t offset,
+        bool regular_file, const mapping_policy& policy)
+{
+    stopwatch sw("mmap(MAP_POPULATE): ", policy.report);
+    stats::add_syscall();
+    void* m = ::mmap(nullptr, length, prot, MAP_SHARED | MAP_POPULATE, fd, offset);
+    if(m != MAP_FAILED){
+        advise(m, length, regular_file, policy);
+    }
+    return m;
+}
+
+void* map_pages(int fd, std::size_t length, int prot, off_t offset,
+        bool regular_file, const mapping_policy& policy)
+{
+    stats::timer t(phase::MMAP);
+
+    // a single page, e.g. of a few registers, is faulted in on the access,
+    // for less than the system calls to advise and populate it would cost.
+    static const std::size_t page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    const bool populate = policy.populate && page_size < length;
+    if(populate && refuses_populate(fd)){
+        return map_populated(fd, length, prot, offset, regular_file, policy);
+    }
+
+    void* m;
+    {
+        stopwatch sw("mmap: ", policy.report);
+        stats::add_syscall();
+        m = ::mmap(nullptr, length, prot, MAP_SHARED, fd, offset);
+    }
+    if(m == MAP_FAILED || length <= page_size){
+        return m;
+    }
+
+    // the hints are given before the pages are populated, so that they can
+    // already be backed by huge pages, and be read ahead.
+    advise(m, length, regular_file, policy);
+
+    if(!populate){
+        return m;
+    }
+
+    {
+        stopwatch sw("populate: ", policy.report);
+        const int advice = prot & PROT_WRITE ? MADV_POPULATE_WRITE : MADV_POPULATE_READ;
+        stats::add_syscall();
+        if(madvise(m, length, advice) == 0){
+            return m;
+        }
+    }
+
+    const int error = errno;
+    stats::add_syscall();
+    ::munmap(m, length);
+    if(error != EINVAL){
+        errno = error;
+        return MAP_FAILED;
+    }
+
+    // MADV_POPULATE_* is new in linux 5.14, and device memory doesn't take it,
+    // so the region is mapped again with MAP_POPULATE instead.
+    {
+        std::lock_guard<std::mutex> lock(refusing_mutex);
+        refusing_fds.insert(fd);
+    }
+    return map_populated(fd, length, prot, offset, regular_file, policy);
+}
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
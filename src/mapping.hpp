@@ -0,0 +1,41 @@
+#ifndef MAPPING_HPP_
+#define MAPPING_HPP_
+
+#include <cstddef>
+#include <string>
+#include <sys/types.h>
+
+// how the regions get mapped.
+struct mapping_policy{
+    mapping_policy():
+        window(),
+        populate(true),
+        sequential(),
+        willneed(),
+        hugepage(),
+        report(){}
+
+    // regions larger than this are mapped window by window. 0 stands for no limit.
+    std::size_t window;
+    // prefault the page tables when mapped, rather than on the first access.
+    bool populate;
+    // hints to madvise(2). huge pages are only asked for regular files.
+    bool sequential;
+    bool willneed;
+    bool hugepage;
+    // print how long mapping and populating took.
+    bool report;
+};
+
+// sets the flags of 'policy' from 'str', which is comma separated
+// populate, lazy, sequential, willneed or hugepage.
+void parse_mapping_policy(const std::string& str, mapping_policy& policy);
+
+// maps 'length' bytes of 'fd' from 'offset', which is aligned to a page, as 'policy' says.
+// returns MAP_FAILED on failure, like mmap(2).
+void* map_pages(int fd, std::size_t length, int prot, off_t offset,
+        bool regular_file, const mapping_policy& policy);
+
+#endif // MAPPING_HPP_
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
@@ -5,8 +5,13 @@
 #include <exception>
 #include <sys/resource.h>
 #include "common.hpp"
+#include "executor.hpp"
+#include "histogram.hpp"
 #include "misc.hpp"
 #include "option.hpp"
+#include "server.hpp"
+#include "sighandler.hpp"
+#include "stats.hpp"
 #include "target.hpp"
 
 const char* progname = nullptr;
@@ -30,11 +35,55 @@ int main(int argc, char* argv[])
     try{
         std::shared_ptr<param> param = option_parser(argc, argv).parse_cmdopt();
         sw.set(param->verbose);
-        for(int i = 0; i < param->repeat || param->repeat < 0; ++i){
-            for(const auto& [src, dst]: param->transfers){
-                src->transfer_to(*dst, *param);
+
+        if(!param->serve.empty()){
+            set_repeat_signal_handler();
+            return server(param->serve, *param).run() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if(!param->connect.empty()){
+            return request(param->connect, param->specs, STDOUT_FILENO) == 0
+                ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        // the setup of the transfers is done once here, out of the repeat loop.
+        const executor plan(*param);
+        stats::emit("setup", -1, -1);
+
+        latency_histogram histogram;
+        if(param->latency){
+            set_repeat_signal_handler();
+            // measured here, rather than in the first report in the middle of the loop.
+            tick_clock::ticks_per_ns();
+        }
+        std::size_t failures = 0;
+        for(int i = 0; (i < param->repeat || param->repeat < 0) && !stop_requested() && failures == 0; ++i){
+            const std::uint64_t start = param->latency ? tick_clock::now() : 0;
+            if(param->concurrent){
+                failures = plan.run_all();
+                stats::emit("transfer", i, -1);
+            }else{
+                for(std::size_t n = 0; n < plan.size(); ++n){
+                    // e.g. SRC=REF has found differences.
+                    if(plan.run(n) != 0){
+                        ++failures;
+                    }
+                    stats::emit("transfer", i, static_cast<long>(n));
+                }
+            }
+            if(param->latency){
+                histogram.record(tick_clock::now() - start);
+                if(take_report_request()){
+                    histogram.report(std::cerr);
+                }
             }
         }
+        if(param->latency){
+            histogram.report(std::cerr);
+        }
+        if(0 < failures){
+            sw.set(false);
+            return EXIT_FAILURE;
+        }
     }catch(const std::exception&){
         sw.set(false);
         return EXIT_FAILURE;
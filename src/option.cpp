@@ -1,22 +1,48 @@
 #include "option.hpp"
 
-#include <regex>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <vector>
 #include <getopt.h>
 #include "sched.hpp"
 #include <unistd.h>
+#include "checksum.hpp"
 #include "common.hpp"
+#include "copykernel.hpp"
 #include "misc.hpp"
+#include "pattern.hpp"
+#include "stats.hpp"
 #include "target.hpp"
+#include "uring.hpp"
 
-#define REGEX_RANGE(capgrp) \
-    "(" capgrp "(?:[[:digit:]]+|0x[[:xdigit:]]+)[kmgKMG]?)" "@" \
-    "(" capgrp "(?:[[:digit:]]+|0x[[:xdigit:]]+)[kmgKMG]?)"
-
-#define REGEX_TARGET \
-    "((?:" REGEX_RANGE("?:") ")|(?:[[:graph:]]+))"
-
-#define REGEX_TRANSFER \
-    REGEX_TARGET ":" REGEX_TARGET
+enum long_only_option{
+    OPTION_CPUS = 0x100,
+    OPTION_NUMA_NODE,
+    OPTION_COPY_KERNEL,
+    OPTION_NT_THRESHOLD,
+    OPTION_BUFFER_SIZE,
+    OPTION_WINDOW,
+    OPTION_MMAP,
+    OPTION_IO_ENGINE,
+    OPTION_QUEUE_DEPTH,
+    OPTION_BLOCK_SIZE,
+    OPTION_CHUNK_SIZE,
+    OPTION_SYNC,
+    OPTION_DEVICE,
+    OPTION_STATS,
+    OPTION_LATENCY,
+    OPTION_FROM_FILE,
+    OPTION_FROM_STDIN,
+    OPTION_SERVE,
+    OPTION_CONNECT,
+    OPTION_CONCURRENT,
+    OPTION_MAX_MISMATCHES,
+    OPTION_CHECKSUM,
+    OPTION_SEARCH,
+};
 
 #ifndef PACKAGE_NAME
 #define PACKAGE_NAME "THIS-TOOL"
@@ -63,15 +89,148 @@ Options:
     -s POLICY,              specify thread scheduling policy.
     --schedule POLICY       POLICY is either of
                             other, fifo, rr, batch, iso, idle, deadline.
-    -j N, --jobs N          allow N threads at once.
+    -j N, --jobs N          allow N threads at once. N is either of an
+                            integer greater than zero, or auto, which
+                            allows as many as the cpus of --cpus, or the
+                            ones the process may run on, and splits a copy
+                            among only as many of them as pay off for its
+                            size, by a short benchmark of --copy-kernel
+                            before the first transfer.
+                            the result is kept in
+                            $XDG_CACHE_HOME/masterkey/calibration.
+    --cpus LIST             pin the threads to the cpus in LIST, one each.
+                            the calling thread is pinned to the first one
+                            only while a transfer runs. LIST is comma
+                            separated cpu numbers or ranges, e.g. 0-3,8-11.
+    --numa-node NODE        bind mapped destination memory to numa node NODE.
+                            unless --cpus is given, the threads are pinned to
+                            the cpus of NODE.
+    --copy-kernel KERNEL    specify the kernel used for memory to memory copy.
+                            KERNEL is either of
+                            auto, portable, sse2, avx2, avx512.
+                            by default, auto is used, which picks the widest
+                            one the cpu supports for non-temporal copies.
+    --nt-threshold SIZE     copies of SIZE bytes or more use non-temporal
+                            stores, which don't pollute the cache.
+                            SIZE takes the same form as LENGTH.
+                            by default, the size of the last level cache.
+    --buffer-size SIZE      size of the buffer used to copy between files
+                            when the kernel can't do it by itself
+                            (copy_file_range, sendfile, splice).
+                            SIZE takes the same form as LENGTH.
+                            by default, 16 pages.
+    --window SIZE           map regions larger than SIZE bytes window by
+                            window, instead of as a whole, while the next
+                            window is mapped in the background. this bounds
+                            the memory used for page tables and lets the
+                            transfer start immediately.
+                            SIZE takes the same form as LENGTH, and is
+                            rounded up to a multiple of the page size.
+                            by default, regions are mapped as a whole.
+    --mmap POLICY           specify how regions are mapped. POLICY is comma
+                            separated flags of
+                            populate: prefault the page tables at once.
+                            lazy: fault the pages in on the first access.
+                            sequential, willneed: give the hint to madvise.
+                            hugepage: back regular files with huge pages,
+                            if the kernel allows.
+                            by default, populate is used. with -v, how long
+                            mapping and populating took is reported.
+    --io-engine ENGINE      specify how mapped regions are written to files.
+                            ENGINE is either of
+                            threads: each of the jobs writes its own slice.
+                            uring: a single thread keeps writes of
+                            --block-size bytes in flight through io_uring.
+                            by default, threads is used. if io_uring is not
+                            available, threads is used instead.
+    --queue-depth N         keep up to N writes in flight with io_uring.
+                            by default, 32.
+    --block-size SIZE       size of each write with io_uring.
+                            SIZE takes the same form as LENGTH.
+                            by default, 1M.
+    --chunk-size SIZE       split copies and writes with --jobs into chunks
+                            of SIZE, rounded up to the page size. each job
+                            takes its own chunks first, then the ones left
+                            to the others. SIZE takes the same form as
+                            LENGTH. by default, 1/8 of each job's share.
+    --sync MODE             specify how DST is synchronized after each
+                            transfer. MODE is either of
+                            full: msync the pages written, and fsync.
+                            data: msync, and fdatasync, which leaves out
+                            the metadata not needed to read the data.
+                            none: leave the writeback to the kernel.
+                            by default, full is used. a DST other than a
+                            regular file or a block device, e.g. /dev/mem
+                            or a pipe, is never synchronized.
+    --device PATH           access PATH for LENGTH@OFFSET, instead of
+                            /dev/mem. e.g. a file on tmpfs, to try without
+                            root privilege.
+    --stats FORMAT[:FD]     write how long each phase took(open, fstat,
+                            mmap, copy, msync, fsync), and how many bytes,
+                            system calls and threads were involved, to FD,
+                            by default 2. a record is written for setting
+                            up the targets, and for each transfer of each
+                            repeat. FORMAT is either of json, csv.
     -r COUNT,               specify repeat count.
     --repeat COUNT          COUNT is a integer greater than zero, or endless.
+    --from-file FILE        read TRANSFERS from FILE, separated by white
+                            spaces, after the ones on the command line.
+                            "-" stands for stdin.
+    --from-stdin            same as --from-file -.
+    --serve SOCKET          serve TRANSFERS sent to the unix domain socket
+                            SOCKET, one per line, until SIGINT or SIGTERM.
+                            ranges are kept mapped between the requests.
+                            the data written to DST "-" is sent back.
+                            the other options apply to all the requests.
+                            only the same user as the server, or root,
+                            may connect. a file at SOCKET other than a
+                            socket is left as it is, and fails.
+    --connect SOCKET        send TRANSFERS to the server at SOCKET instead,
+                            and write the data sent back to stdout.
+    --latency               measure how long each repeat takes, and print
+                            min, p50, p99, p99.9 and max of them to stderr
+                            on exit, and on SIGUSR1. with this, SIGINT and
+                            SIGTERM stop the repeat after the current one.
+    --concurrent            run TRANSFERS at once on up to N threads of
+                            --jobs, except that a TRANSFER waits for the
+                            preceding ones which write what it reads or
+                            writes, or read what it writes. the ones which
+                            depend on a failed one are skipped, and the
+                            failures are reported in the order of TRANSFERS.
+                            with --stats, a record is written for each
+                            repeat, instead of each transfer.
+    --max-mismatches N      write up to N differing words of SRC=REF.
+                            by default, 16.
+    --checksum ALGO         compute a checksum of the data of each transfer
+                            as it's moved, on the jobs, and write it to
+                            stderr. ALGO is either of
+                            crc32c: with the instruction, if the cpu has it.
+                            hash64: a 61-bit polynomial hash, which needs
+                            no special instruction.
+                            auto: crc32c if the cpu has the instruction,
+                            or hash64 otherwise.
+                            none: the default. the kernel moves data between
+                            files by itself only without a checksum.
+    --search NEEDLE         search each of TRANSFERS, which are SRCs alone,
+                            for NEEDLE on the jobs, instead of transferring
+                            them, and write the addresses of the matches to
+                            stdout, a line each. exits with failure if none
+                            is found. NEEDLE is either of
+                            bytes:HEX: a string of bytes, e.g. bytes:5f534d5f.
+                            text:STRING: the bytes of STRING, e.g. text:_SM_.
+                            word:VALUE[/MASK]: a word of --width in --endian
+                            order, at the addresses aligned to it, of which
+                            only the bits set in MASK are compared.
 
 Syntax:
     TRANSFERS       :=  TRANSFER [ " " TRANSFERS ]
-    TRANSFER        :=  SRC ":" DST
+    TRANSFER        :=  { SRC ":" DST | SRC "=" REF }
+                        SRC "=" REF compares SRC with REF, both of which
+                        are regions or files, on the jobs, and exits with
+                        failure if they differ. the first differing words
+                        are written to stdout at --width and --endian.
 
-    SRC             :=  { LENGTH "@" OFFSET | "-" | path-to-a-existing-file }
+    SRC             :=  { LENGTH "@" OFFSET | "-" | PATTERN | path-to-a-existing-file }
     DST             :=  { LENGTH "@" OFFSET | "-" | path-to-a-output-file }
                         LENGTH@OFFSET represents a physical address region
                         which starts at OFFSET and has length LENGTH.
@@ -80,6 +239,15 @@ Syntax:
                         note that when you use stdin you need a preceding
                         "--", which means end of options, to avoid confusion.
 
+    PATTERN         :=  { "zero" | "incr" | "pattern:" VALUE }
+                        fills DST, which is a region, with words of --width
+                        in --endian order, generated on the jobs with the
+                        stores of --copy-kernel. nothing is read.
+                        zero: all zeros.
+                        incr: 0, 1, 2, ... from the beginning of DST.
+                        pattern:VALUE: VALUE, e.g. 0xdeadbeef, repeatedly.
+                        a file of these names needs a path, e.g. ./zero.
+
     LENGTH, OFFSET  :=  {      decimal-digit's
                         | "0x"     hex-digit's
                         |  "0"   octal-digit's } [ SUFFIX ]
@@ -95,11 +263,12 @@ Syntax:
 }
 
 option_parser::option_parser(int argc, char* argv[])
-: argc_(argc), argv_(argv) {}
+: argc_(argc), argv_(argv), cache_(std::make_shared<device_cache>()) {}
 
 std::shared_ptr<param> option_parser::parse_cmdopt()const
 {
     std::shared_ptr<param> prm = std::make_shared<param>();
+    std::vector<std::string> spec_files;
 
     while(true){
         opterr = 0;
@@ -114,6 +283,29 @@ std::shared_ptr<param> option_parser::parse_cmdopt()const
             {"schedule", required_argument, nullptr, 's'},
             {"jobs",     required_argument, nullptr, 'j'},
             {"repeat",   required_argument, nullptr, 'r'},
+            {"cpus",      required_argument, nullptr, OPTION_CPUS},
+            {"numa-node", required_argument, nullptr, OPTION_NUMA_NODE},
+            {"copy-kernel",  required_argument, nullptr, OPTION_COPY_KERNEL},
+            {"nt-threshold", required_argument, nullptr, OPTION_NT_THRESHOLD},
+            {"buffer-size",  required_argument, nullptr, OPTION_BUFFER_SIZE},
+            {"window",       required_argument, nullptr, OPTION_WINDOW},
+            {"mmap",         required_argument, nullptr, OPTION_MMAP},
+            {"io-engine",    required_argument, nullptr, OPTION_IO_ENGINE},
+            {"queue-depth",  required_argument, nullptr, OPTION_QUEUE_DEPTH},
+            {"block-size",   required_argument, nullptr, OPTION_BLOCK_SIZE},
+            {"chunk-size",   required_argument, nullptr, OPTION_CHUNK_SIZE},
+            {"sync",         required_argument, nullptr, OPTION_SYNC},
+            {"device",       required_argument, nullptr, OPTION_DEVICE},
+            {"stats",        required_argument, nullptr, OPTION_STATS},
+            {"latency",            no_argument, nullptr, OPTION_LATENCY},
+            {"from-file",    required_argument, nullptr, OPTION_FROM_FILE},
+            {"from-stdin",         no_argument, nullptr, OPTION_FROM_STDIN},
+            {"serve",        required_argument, nullptr, OPTION_SERVE},
+            {"connect",      required_argument, nullptr, OPTION_CONNECT},
+            {"concurrent",         no_argument, nullptr, OPTION_CONCURRENT},
+            {"max-mismatches", required_argument, nullptr, OPTION_MAX_MISMATCHES},
+            {"checksum",     required_argument, nullptr, OPTION_CHECKSUM},
+            {"search",       required_argument, nullptr, OPTION_SEARCH},
             {}
         };
 
@@ -128,6 +320,11 @@ std::shared_ptr<param> option_parser::parse_cmdopt()const
         case 'e': prm->endianness = to_endian(optarg); break;
         case 'h': show_help(); break;
         case 'j':
+            if(std::string(optarg) == "auto"){
+                prm->auto_jobs = true;
+                break;
+            }
+            prm->auto_jobs = false;
             try{
                 prm->jobs = std::stoi(optarg, nullptr, 0);
             }catch(const std::exception& e){
@@ -161,6 +358,80 @@ std::shared_ptr<param> option_parser::parse_cmdopt()const
                 break;
             }
             break;
+        case OPTION_CPUS: prm->cpus = to_cpu_list(optarg); break;
+        case OPTION_NUMA_NODE:
+            try{
+                prm->numa_node = std::stoi(optarg, nullptr, 0);
+            }catch(const std::exception& e){
+                errno = EINVAL;
+                ERROR_THROW(std::string("can't convert to number: '")
+                        + optarg + "'");
+            }
+            if(prm->numa_node < 0){
+                errno = EINVAL;
+                ERROR_THROW(std::string("invalid value: ")
+                        + std::to_string(prm->numa_node));
+            }
+            break;
+        case OPTION_COPY_KERNEL:
+            prm->kernel = to_copy_kernel(optarg);
+            select_copy_kernel(prm->kernel);
+            break;
+        case OPTION_NT_THRESHOLD: prm->nontemporal_threshold = to_size(optarg); break;
+        case OPTION_BUFFER_SIZE:
+            prm->buffer_size = to_size(optarg);
+            if(prm->buffer_size == 0){
+                errno = EINVAL;
+                ERROR_THROW(std::string("invalid value: ") + optarg);
+            }
+            break;
+        case OPTION_WINDOW: prm->mapping.window = to_size(optarg); break;
+        case OPTION_MMAP: parse_mapping_policy(optarg, prm->mapping); break;
+        case OPTION_IO_ENGINE: prm->engine = to_io_engine(optarg); break;
+        case OPTION_SYNC: prm->sync = to_sync_mode(optarg); break;
+        case OPTION_QUEUE_DEPTH:
+            {
+                int depth = 0;
+                try{
+                    depth = std::stoi(optarg, nullptr, 0);
+                }catch(const std::exception& e){
+                    errno = EINVAL;
+                    ERROR_THROW(std::string("can't convert to number: '")
+                            + optarg + "'");
+                }
+                if(depth < 1){
+                    errno = EINVAL;
+                    ERROR_THROW(std::string("invalid value: ")
+                            + std::to_string(depth));
+                }
+                prm->queue_depth = static_cast<unsigned>(depth);
+            }
+            break;
+        case OPTION_BLOCK_SIZE:
+            prm->block_size = to_size(optarg);
+            if(prm->block_size == 0){
+                errno = EINVAL;
+                ERROR_THROW(std::string("invalid value: ") + optarg);
+            }
+            break;
+        case OPTION_CHUNK_SIZE:
+            prm->chunk_size = to_size(optarg);
+            if(prm->chunk_size == 0){
+                errno = EINVAL;
+                ERROR_THROW(std::string("invalid value: ") + optarg);
+            }
+            break;
+        case OPTION_DEVICE: prm->device = optarg; break;
+        case OPTION_STATS: stats::enable(optarg); break;
+        case OPTION_LATENCY: prm->latency = true; break;
+        case OPTION_FROM_FILE: spec_files.push_back(optarg); break;
+        case OPTION_FROM_STDIN: spec_files.push_back("-"); break;
+        case OPTION_SERVE: prm->serve = optarg; break;
+        case OPTION_CONNECT: prm->connect = optarg; break;
+        case OPTION_CONCURRENT: prm->concurrent = true; break;
+        case OPTION_MAX_MISMATCHES: prm->max_mismatches = to_size(optarg); break;
+        case OPTION_CHECKSUM: prm->checksum = to_checksum_algorithm(optarg); break;
+        case OPTION_SEARCH: prm->search = optarg; break;
         case '?':
             errno = EINVAL;
             ERROR_THROW(std::string("unknown option: '")
@@ -171,68 +442,193 @@ std::shared_ptr<param> option_parser::parse_cmdopt()const
         }
     }
 
+    prm->mapping.report = prm->verbose;
+
+    if(0 <= prm->numa_node && prm->cpus.empty()){
+        prm->cpus = numa_node_cpus(prm->numa_node);
+    }
+    // as many as the cpus the threads are pinned to, or the process may run on.
+    if(prm->auto_jobs){
+        prm->jobs = prm->cpus.empty() ? count_allowed_cpus() : static_cast<int>(prm->cpus.size());
+    }
+
     for(int i = optind; i < argc_; ++i){
-        prm->transfers.emplace_back(to_transfer(argv_[i]));
+        prm->specs.push_back(argv_[i]);
+    }
+
+    for(const std::string& file: spec_files){
+        std::ifstream ifs;
+        if(file != "-"){
+            ifs.open(file);
+            if(!ifs){
+                ERROR_THROW(file);
+            }
+        }
+        std::istream& is = file == "-" ? std::cin : ifs;
+        for(std::string spec; is >> spec;){
+            prm->specs.push_back(spec);
+        }
+        if(is.bad()){
+            ERROR_THROW(file);
+        }
+    }
+
+    // all the ranges are told to the cache first, so that the ones close
+    // to each other share a mapping.
+    for(const std::string& spec: prm->specs){
+        std::string src = spec, dst;
+        bool compare = false;
+        if(prm->search.empty()){
+            parse_transfer(spec, src, dst, compare);
+        }
+        const target_role dst_role = compare ? target_role::SRC : target_role::DST;
+        for(const auto& [str, role]: {std::pair{src, target_role::SRC}, {dst, dst_role}}){
+            std::size_t offset, length;
+            if(lex_range(str, 0, str.size(), offset, length)){
+                cache_->reserve(prm->device, role, offset, length, prm->mapping.window);
+            }
+        }
+    }
+
+    // with --connect, the targets are opened by the server instead.
+    if(prm->connect.empty()){
+        for(const std::string& spec: prm->specs){
+            prm->transfers.emplace_back(to_transfer(spec, *prm));
+        }
     }
 
     return prm;
 }
 
-transfer option_parser::to_transfer(const std::string& spec)const
+transfer option_parser::to_transfer(const std::string& spec, const param& prm)const
 {
+    if(!prm.search.empty()){
+        return transfer{to_target(spec, target_role::SRC, prm), nullptr};
+    }
+
     std::string src, dst;
-    parse_transfer(spec, src, dst);
+    bool compare;
+    parse_transfer(spec, src, dst, compare);
+    // both sides of a comparison are only read.
     return transfer{
-        to_target(src, target_role::SRC),
-        to_target(dst, target_role::DST)
+        to_target(src, target_role::SRC, prm),
+        to_target(dst, compare ? target_role::SRC : target_role::DST, prm),
+        compare
     };
 }
 
-std::shared_ptr<target> option_parser::to_target(const std::string& spec, const target_role& role)const
+std::shared_ptr<target> option_parser::to_target(const std::string& spec, const target_role& role,
+        const param& prm)const
 {
     std::size_t offset;
     std::size_t length;
-    try{
-        parse_range(spec, offset, length);
-    }catch(const std::runtime_error&){
-        if(spec == "-"){
-            return std::make_shared<target>(role == target_role::SRC ? STDIN_FILENO : STDOUT_FILENO);
+    if(lex_range(spec, 0, spec.size(), offset, length)){
+        return std::make_shared<target>(*cache_, prm.device, role, offset, length, prm.mapping);
+    }
+    if(spec == "-"){
+        return std::make_shared<target>(role == target_role::SRC ? STDIN_FILENO : STDOUT_FILENO);
+    }
+    if(pattern::is_pattern(spec)){
+        if(role != target_role::SRC){
+            errno = EINVAL;
+            ERROR_THROW(std::string("a pattern can only be SRC: '") + spec + "'");
         }
-        return std::make_shared<target>(spec, role);
+        return std::make_shared<target>(pattern::parse(spec, prm.width, prm.endianness));
     }
-    return std::make_shared<target>("/dev/mem", role, offset, length);
+    return std::make_shared<target>(spec, role, 0, 0, prm.mapping);
 }
 
 void option_parser::parse_transfer(const std::string& str, std::string& src, std::string& dst)const
 {
-    std::smatch m;
-    if(!std::regex_match(str, m, std::regex(REGEX_TRANSFER))){
+    bool compare;
+    parse_transfer(str, src, dst, compare);
+    if(compare){
+        errno = EINVAL;
+        ERROR_THROW(std::string("\"") + str + '"');
+    }
+}
+
+void option_parser::parse_transfer(const std::string& str, std::string& src, std::string& dst,
+        bool& compare)const
+{
+    // TRANSFER is SRC ":" DST, or SRC "=" DST, which is only looked for if there is no ":".
+    // SRC is taken as a range if it can be one, otherwise as the longest path that
+    // leaves DST nonempty. both consist of printable characters other than space.
+    const bool graph = std::all_of(str.begin(), str.end(),
+            [](char c){return '!' <= c && c <= '~';});
+    std::size_t sep = std::string::npos;
+    for(const char c: {':', '='}){
+        sep = str.find(c);
+        std::size_t offset, length;
+        if(sep != std::string::npos && !lex_range(str, 0, sep, offset, length)){
+            sep = str.size() < 2 ? std::string::npos : str.rfind(c, str.size() - 2);
+        }
+        if(sep != std::string::npos){
+            compare = c == '=';
+            break;
+        }
+    }
+    if(!graph || sep == 0 || sep == std::string::npos || sep + 1 == str.size()){
         errno = EINVAL;
         ERROR_THROW(std::string("\"") + str + '"');
     }
 
-    src = m.str(1);
-    dst = m.str(2);
+    src = str.substr(0, sep);
+    dst = str.substr(sep + 1);
 }
 
 void option_parser::parse_range(const std::string& str, std::size_t& offset, std::size_t& length)const
 {
-    std::smatch m;
-    if(!std::regex_match(str, m, std::regex(REGEX_RANGE("")))){
+    if(!lex_range(str, 0, str.size(), offset, length)){
         errno = EINVAL;
         throw std::runtime_error(std::to_string(-errno));
     }
+}
 
-    std::size_t idx;
+bool option_parser::is_range(const std::string& spec)
+{
+    std::size_t offset, length;
+    return lex_range(spec, 0, spec.size(), offset, length);
+}
 
-    length = std::stoul(m.str(1), &idx, 0);
-    if(idx < m.str(1).size()){
-        length *= to_number(m.str(1).at(idx));
+bool option_parser::lex_range(const std::string& str, std::size_t first, std::size_t last,
+        std::size_t& offset, std::size_t& length)
+{
+    const std::size_t at = str.find('@', first);
+    return at < last
+        && lex_number(str, first, at, length)
+        && lex_number(str, at + 1, last, offset);
+}
+
+bool option_parser::lex_number(const std::string& str, std::size_t first, std::size_t last,
+        std::size_t& value)
+{
+    // { digit's | "0x" hex-digit's } [ SUFFIX ]
+    const std::size_t suffix = first < last ? to_number(str[last - 1]) : 1;
+    if(1 < suffix){
+        --last;
+    }
+    if(first == last){
+        return false;
     }
-    offset = std::stoul(m.str(2), &idx, 0);
-    if(idx < m.str(2).size()){
-        offset *= to_number(m.str(2).at(idx));
+
+    const bool hex = 2 < last - first && str[first] == '0' && str[first + 1] == 'x';
+    for(std::size_t i = first + (hex ? 2 : 0); i < last; ++i){
+        const int c = static_cast<unsigned char>(str[i]);
+        if(!(hex ? std::isxdigit(c) : std::isdigit(c))){
+            return false;
+        }
     }
+
+    // converted in the same way as strtoul(3) with base 0, e.g. a leading 0 stands for octal.
+    const std::string digits = str.substr(first, last - first);
+    errno = 0;
+    const unsigned long n = std::strtoul(digits.c_str(), nullptr, 0);
+    if(errno == ERANGE){
+        ERROR_THROW(std::string("can't convert to number: '") + digits + "'");
+    }
+    value = static_cast<std::size_t>(n) * suffix;
+    return true;
 }
 
 std::size_t option_parser::to_number(char suffix)
@@ -247,6 +643,28 @@ std::size_t option_parser::to_number(char suffix)
     return n;
 }
 
+std::size_t option_parser::to_size(const std::string& spec)
+{
+    std::size_t size = 0;
+    std::size_t idx = 0;
+    try{
+        size = std::stoul(spec, &idx, 0);
+    }catch(const std::exception& e){
+        errno = EINVAL;
+        ERROR_THROW(std::string("can't convert to number: '")
+                + spec + "'");
+    }
+
+    if(idx + 1 == spec.size() && std::string("kmgKMG").find(spec.at(idx)) != std::string::npos){
+        size *= to_number(spec.at(idx));
+    }else if(idx != spec.size()){
+        errno = EINVAL;
+        ERROR_THROW(std::string("can't convert to number: '")
+                + spec + "'");
+    }
+    return size;
+}
+
 int option_parser::to_repeat(const std::string& spec)
 {
     if(spec == "endless"){
@@ -13,22 +13,37 @@
 class option_parser{
 public:
     option_parser(int argc, char* argv[]);
+    option_parser(const option_parser&) = default;
+    option_parser& operator=(const option_parser&) = default;
 
     std::shared_ptr<param> parse_cmdopt()const;
 
-    transfer to_transfer(const std::string& spec)const;
-    std::shared_ptr<target> to_target(const std::string& spec, const target_role& role)const;
+    transfer to_transfer(const std::string& spec, const param& prm)const;
+    std::shared_ptr<target> to_target(const std::string& spec, const target_role& role,
+            const param& prm)const;
 
+    // throws if 'str' is a comparison.
     void parse_transfer(const std::string& str, std::string& src, std::string& dst)const;
+    void parse_transfer(const std::string& str, std::string& src, std::string& dst,
+            bool& compare)const;
     void parse_range(const std::string& str, std::size_t& offset, std::size_t& length)const;
+    static bool is_range(const std::string& spec);
 
 private:
     static std::size_t to_number(char suffix);
+    static std::size_t to_size(const std::string& spec);
     static int to_repeat(const std::string& spec);
+    // both return false unless [first, last) of 'str' is a range or a number of it.
+    static bool lex_range(const std::string& str, std::size_t first, std::size_t last,
+            std::size_t& offset, std::size_t& length);
+    static bool lex_number(const std::string& str, std::size_t first, std::size_t last,
+            std::size_t& value);
 
 private:
     int argc_;
     char** argv_;
+    // shared by the targets of ranges this makes.
+    std::shared_ptr<device_cache> cache_;
 };
 
 #endif // OPTION_HPP_
@@ -0,0 +1,106 @@
+#include "pattern.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include "checksum.hpp"
+#include "misc.hpp"
+#include "target.hpp"
+
+pattern::pattern(pattern_kind kind, std::uint64_t value, int width, endian e):
+    kind_(kind),
+    value_(value),
+    word_size_(static_cast<std::size_t>(width) / 8),
+    big_endian_(e == endian::BIG
+            || (e == endian::HOST && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__))
+{
+    if(width != 8 && width != 16 && width != 32 && width != 64){
+        errno = EINVAL;
+        ERROR_THROW(std::string("unsupported bit width: ") + std::to_string(width));
+    }
+    if(width < 64 && (value >> width) != 0){
+        errno = EINVAL;
+        ERROR_THROW("pattern wider than --width");
+    }
+}
+
+bool pattern::is_pattern(const std::string& spec)
+{
+    return spec == "zero" || spec == "incr" || spec.compare(0, 8, "pattern:") == 0;
+}
+
+pattern pattern::parse(const std::string& spec, int width, endian e)
+{
+    if(spec == "zero"){
+        return pattern(pattern_kind::ZERO, 0, width, e);
+    }
+    if(spec == "incr"){
+        return pattern(pattern_kind::INCREMENT, 0, width, e);
+    }
+
+    const std::string digits = spec.substr(spec.find(':') + 1);
+    char* end = nullptr;
+    errno = 0;
+    const std::uint64_t value = static_cast<std::uint64_t>(std::strtoull(digits.c_str(), &end, 0));
+    if(digits.empty() || *end != '\0' || digits.front() == '-' || errno == ERANGE){
+        errno = EINVAL;
+        ERROR_THROW(std::string("invalid pattern: '") + spec + "'");
+    }
+    return pattern(pattern_kind::CONSTANT, value, width, e);
+}
+
+void pattern::fill(char* dest, std::size_t pos, std::size_t n, copy_function copy,
+        bool nontemporal, checksum* sum)const
+{
+    alignas(64) char block[block_size];
+    // the digest of a whole block of a constant, which is computed only once as well.
+    std::uint64_t digest = 0;
+    for(std::size_t done = 0; done < n;){
+        const std::size_t len = std::min(block_size, n - done);
+        // a constant repeats itself block by block, which is generated only once.
+        const bool generated = done == 0 || kind_ == pattern_kind::INCREMENT;
+        if(generated){
+            generate(block, pos + done, len);
+        }
+        if(sum){
+            if(kind_ == pattern_kind::INCREMENT || len < block_size){
+                sum->update(block, len);
+            }else{
+                if(generated){
+                    digest = sum->compute(block, len);
+                }
+                sum->append(digest, len);
+            }
+        }
+        copy(dest + done, block, len, nontemporal);
+        done += len;
+    }
+}
+
+void pattern::generate(char* out, std::size_t pos, std::size_t n)const
+{
+    if(kind_ == pattern_kind::ZERO){
+        std::fill_n(out, n, 0);
+        return;
+    }
+
+    char word[sizeof(std::uint64_t)];
+    std::size_t k = pos / word_size_;
+    std::size_t head = pos % word_size_;
+    for(std::size_t i = 0; i < n; ++k, head = 0){
+        store(word, kind_ == pattern_kind::CONSTANT ? value_ : k);
+        const std::size_t len = std::min(word_size_ - head, n - i);
+        std::copy_n(word + head, len, out + i);
+        i += len;
+    }
+}
+
+void pattern::store(char* out, std::uint64_t word)const
+{
+    for(std::size_t i = 0; i < word_size_; ++i){
+        const std::size_t shift = 8 * (big_endian_ ? word_size_ - 1 - i : i);
+        out[i] = static_cast<char>(word >> shift);
+    }
+}
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
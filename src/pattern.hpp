@@ -0,0 +1,50 @@
+#ifndef PATTERN_HPP_
+#define PATTERN_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "copykernel.hpp"
+#include "fwd.hpp"
+
+enum class pattern_kind{
+    ZERO,
+    // the same word over and over.
+    CONSTANT,
+    // the words count up from 0 at the beginning of the region.
+    INCREMENT,
+};
+
+// data generated for a synthetic SRC, "zero", "incr" or "pattern:VALUE", in words of
+// --width bits in --endian order. it has no length, and fills as much as DST has.
+class pattern{
+public:
+    pattern(pattern_kind kind, std::uint64_t value, int width, endian e);
+
+    // whether 'spec' names a pattern rather than a file.
+    static bool is_pattern(const std::string& spec);
+    static pattern parse(const std::string& spec, int width, endian e);
+
+    // writes [pos, pos + n) of the pattern to 'dest' through 'copy', a block at a time,
+    // so that the kernel's wide or non-temporal stores are used without any source
+    // but a block in the cache. the blocks are appended to 'sum', if any, as generated.
+    void fill(char* dest, std::size_t pos, std::size_t n, copy_function copy, bool nontemporal,
+            checksum* sum = nullptr)const;
+    // writes [pos, pos + n) of the pattern to 'out' directly.
+    void generate(char* out, std::size_t pos, std::size_t n)const;
+
+private:
+    // a multiple of any width, so that a block of a constant starts at the same byte of a word.
+    static constexpr std::size_t block_size = 4096;
+
+    void store(char* out, std::uint64_t word)const;
+
+    const pattern_kind kind_;
+    const std::uint64_t value_;
+    const std::size_t word_size_;
+    const bool big_endian_;
+};
+
+#endif // PATTERN_HPP_
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
@@ -1,4 +1,10 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <sched.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
 #include "misc.hpp"
 #include "sched.hpp"
 
@@ -50,4 +56,111 @@ void set_scheduling_policy(int policy)
     }
 }
 
+std::vector<int> to_cpu_list(const std::string& str)
+{
+    std::vector<int> cpus;
+    std::size_t pos = 0;
+    for(std::size_t end = 0; end < str.size(); pos = end + 1){
+        end = std::min(str.find(',', pos), str.size());
+        const std::string item = str.substr(pos, end - pos);
+
+        int first, last;
+        try{
+            std::size_t idx;
+            first = last = std::stoi(item, &idx, 10);
+            if(idx < item.size()){
+                if(item.at(idx) != '-'){
+                    throw std::invalid_argument(item);
+                }
+                const std::string rest = item.substr(idx + 1);
+                last = std::stoi(rest, &idx, 10);
+                if(idx < rest.size()){
+                    throw std::invalid_argument(item);
+                }
+            }
+        }catch(const std::exception&){
+            errno = EINVAL;
+            ERROR_THROW("invalid cpu list: '" + str + "'");
+        }
+        if(first < 0 || last < first || CPU_SETSIZE <= last){
+            errno = EINVAL;
+            ERROR_THROW("invalid cpu list: '" + str + "'");
+        }
+        for(int cpu = first; cpu <= last; ++cpu){
+            cpus.push_back(cpu);
+        }
+    }
+
+    if(cpus.empty()){
+        errno = EINVAL;
+        ERROR_THROW("empty cpu list");
+    }
+    return cpus;
+}
+
+std::vector<int> numa_node_cpus(int node)
+{
+    const std::string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+    std::ifstream ifs(path);
+    std::string list;
+    if(!(ifs >> list)){
+        errno = EINVAL;
+        ERROR_THROW("no such numa node: " + std::to_string(node));
+    }
+    return to_cpu_list(list);
+}
+
+void set_cpu_affinity(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(static_cast<std::size_t>(cpu), &set);
+
+    if(sched_setaffinity(0, sizeof(set), &set) == -1){
+        ERROR_THROW("sched_setaffinity: cpu " + std::to_string(cpu));
+    }
+}
+
+cpu_affinity_scope::cpu_affinity_scope(const std::vector<int>& cpus)
+: pinned_(false),
+saved_()
+{
+    if(cpus.empty()){
+        return;
+    }
+    if(sched_getaffinity(0, sizeof(saved_), &saved_) == -1){
+        ERROR_THROW("sched_getaffinity");
+    }
+    set_cpu_affinity(cpus.front());
+    pinned_ = true;
+}
+
+cpu_affinity_scope::~cpu_affinity_scope()
+{
+    if(pinned_ && sched_setaffinity(0, sizeof(saved_), &saved_) == -1){
+        WARN(std::string("sched_setaffinity: ") + std::strerror(errno));
+    }
+}
+
+int count_allowed_cpus()
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) == -1){
+        ERROR_THROW("sched_getaffinity");
+    }
+    return std::max(1, CPU_COUNT(&set));
+}
+
+long bind_to_numa_node(void* addr, std::size_t length, int node)
+{
+    constexpr std::size_t bits = sizeof(unsigned long) * 8;
+    std::vector<unsigned long> nodemask(static_cast<std::size_t>(node) / bits + 1);
+    nodemask.at(static_cast<std::size_t>(node) / bits) |= 1ul << (static_cast<std::size_t>(node) % bits);
+
+    // MPOL_MF_MOVE also migrates pages which MAP_POPULATE has already faulted in.
+    return syscall(SYS_mbind, addr, length, MPOL_BIND, nodemask.data(),
+            nodemask.size() * bits + 1, MPOL_MF_MOVE);
+}
+
 // vim: set expandtab shiftwidth=0 tabstop=4 :
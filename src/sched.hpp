@@ -1,12 +1,40 @@
 #ifndef SCHED_HPP_
 #define SCHED_HPP_
 
+#include <cstddef>
+#include <sched.h>
 #include <string>
+#include <vector>
 
 int to_scheduling_policy(const std::string& str);
 
 void set_scheduling_policy(int policy);
 
+std::vector<int> to_cpu_list(const std::string& str);
+
+std::vector<int> numa_node_cpus(int node);
+
+void set_cpu_affinity(int cpu);
+
+// pins the calling thread to the first of 'cpus', if any, while it lives,
+// and lets the thread run on the cpus it could before afterwards.
+class cpu_affinity_scope{
+public:
+    explicit cpu_affinity_scope(const std::vector<int>& cpus);
+    cpu_affinity_scope(const cpu_affinity_scope&) = delete;
+    cpu_affinity_scope& operator=(const cpu_affinity_scope&) = delete;
+    ~cpu_affinity_scope();
+
+private:
+    bool pinned_;
+    cpu_set_t saved_;
+};
+
+// the number of cpus the calling thread may run on.
+int count_allowed_cpus();
+
+long bind_to_numa_node(void* addr, std::size_t length, int node);
+
 #endif // SCHED_HPP_
 
 // vim: set expandtab shiftwidth=0 tabstop=4 :
@@ -0,0 +1,281 @@
+#include "search.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "copykernel.hpp"
+#include "misc.hpp"
+#include "target.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static std::uint64_t to_word(const std::string& digits, int width, const std::string& spec)
+{
+    char* end = nullptr;
+    errno = 0;
+    const std::uint64_t value = static_cast<std::uint64_t>(std::strtoull(digits.c_str(), &end, 0));
+    if(digits.empty() || *end != '\0' || digits.front() == '-' || errno == ERANGE
+            || (width < 64 && (value >> width) != 0)){
+        errno = EINVAL;
+        ERROR_THROW(std::string("invalid needle: '") + spec + "'");
+    }
+    return value;
+}
+
+// the bytes of 'word' in memory, at 'width' in the order of 'e'.
+static std::string to_bytes(std::uint64_t word, int width, endian e)
+{
+    const std::size_t size = static_cast<std::size_t>(width) / 8;
+    const bool big = e == endian::BIG || (e == endian::HOST && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__);
+    std::string bytes(size, '\0');
+    for(std::size_t i = 0; i < size; ++i){
+        bytes[i] = static_cast<char>(word >> (8 * (big ? size - 1 - i : i)));
+    }
+    return bytes;
+}
+
+needle::needle(const std::string& spec, int width, endian e, copy_kernel kernel):
+    bytes_(), mask_(), find_()
+{
+    const std::size_t colon = spec.find(':');
+    const std::string kind = spec.substr(0, colon);
+    const std::string body = colon == std::string::npos ? std::string() : spec.substr(colon + 1);
+
+    if(kind == "text"){
+        bytes_ = body;
+    }else if(kind == "bytes"){
+        const bool hex = body.size() % 2 == 0 && std::all_of(body.begin(), body.end(),
+                [](char c){return std::isxdigit(static_cast<unsigned char>(c)) != 0;});
+        for(std::size_t i = 0; hex && i < body.size(); i += 2){
+            bytes_.push_back(static_cast<char>(std::stoul(body.substr(i, 2), nullptr, 16)));
+        }
+        if(!hex){
+            bytes_.clear();
+        }
+    }else if(kind == "word"){
+        if(width != 8 && width != 16 && width != 32 && width != 64){
+            errno = EINVAL;
+            ERROR_THROW(std::string("unsupported bit width: ") + std::to_string(width));
+        }
+        const std::size_t slash = body.find('/');
+        const std::uint64_t mask = slash == std::string::npos ? ~std::uint64_t(0)
+            : to_word(body.substr(slash + 1), width, spec);
+        const std::uint64_t value = to_word(body.substr(0, slash), width, spec);
+        // the bits out of the mask are cleared, so that they're compared as zeros.
+        bytes_ = to_bytes(value & mask, width, e);
+        mask_ = to_bytes(mask, width, e);
+    }
+
+    if(bytes_.empty() || max_size < bytes_.size()){
+        errno = EINVAL;
+        ERROR_THROW(std::string("invalid needle: '") + spec + "'");
+    }
+    find_ = select(!mask_.empty(), kernel);
+}
+
+static std::size_t find_bytes_portable(const unsigned char* p, std::size_t n,
+        const unsigned char* bytes, const unsigned char*, std::size_t size)
+{
+    if(n < size){
+        return n;
+    }
+    // the candidates are where the first byte is, which memchr finds.
+    const std::size_t end = n - size + 1;
+    for(std::size_t i = 0; i < end; ++i){
+        const void* q = std::memchr(p + i, bytes[0], end - i);
+        if(!q){
+            break;
+        }
+        i = static_cast<std::size_t>(static_cast<const unsigned char*>(q) - p);
+        if(std::memcmp(p + i + 1, bytes + 1, size - 1) == 0){
+            return i;
+        }
+    }
+    return n;
+}
+
+// a word is loaded as an integer, which holds it in the same order as the needle.
+static std::size_t find_word_portable(const unsigned char* p, std::size_t n,
+        const unsigned char* bytes, const unsigned char* mask, std::size_t size)
+{
+    std::uint64_t value = 0;
+    std::uint64_t m = 0;
+    std::memcpy(&value, bytes, size);
+    std::memcpy(&m, mask, size);
+
+    for(std::size_t i = (size - reinterpret_cast<std::uintptr_t>(p) % size) % size; i + size <= n; i += size){
+        std::uint64_t x = 0;
+        std::memcpy(&x, p + i, size);
+        if((x & m) == value){
+            return i;
+        }
+    }
+    return n;
+}
+
+// a bit per byte of a vector of 'lanes' bytes, set at each word of 'size' bytes.
+static std::uint32_t word_starts(std::size_t size, std::size_t lanes)
+{
+    std::uint32_t starts = 0;
+    for(std::size_t i = 0; i < lanes; i += size){
+        starts |= std::uint32_t(1) << i;
+    }
+    return starts;
+}
+
+// a bit per byte, which is set if the whole word from it matches.
+static std::uint32_t whole_words(std::uint32_t equal, std::size_t size, std::uint32_t starts)
+{
+    for(std::size_t s = 1; s < size; s <<= 1){
+        equal &= equal >> s;
+    }
+    return equal & starts;
+}
+
+#if defined(__x86_64__)
+
+// the candidates are where both the first and the last byte are, in a vector of them.
+static std::size_t find_bytes_sse2(const unsigned char* p, std::size_t n,
+        const unsigned char* bytes, const unsigned char* mask, std::size_t size)
+{
+    std::size_t i = 0;
+    const __m128i first = _mm_set1_epi8(static_cast<char>(bytes[0]));
+    const __m128i last = _mm_set1_epi8(static_cast<char>(bytes[size - 1]));
+    for(; size <= n && i + size - 1 + 16 <= n; i += 16){
+        const __m128i a = _mm_loadu_si128(static_cast<const __m128i*>(static_cast<const void*>(p + i)));
+        const __m128i b = _mm_loadu_si128(
+                static_cast<const __m128i*>(static_cast<const void*>(p + i + size - 1)));
+        unsigned m = static_cast<unsigned>(_mm_movemask_epi8(
+                    _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last))));
+        for(; m != 0; m &= m - 1){
+            const std::size_t j = i + static_cast<std::size_t>(__builtin_ctz(m));
+            if(size < 3 || std::memcmp(p + j + 1, bytes + 1, size - 2) == 0){
+                return j;
+            }
+        }
+    }
+    return i + find_bytes_portable(p + i, n - i, bytes, mask, size);
+}
+
+__attribute__((target("avx2")))
+static std::size_t find_bytes_avx2(const unsigned char* p, std::size_t n,
+        const unsigned char* bytes, const unsigned char* mask, std::size_t size)
+{
+    std::size_t i = 0;
+    const __m256i first = _mm256_set1_epi8(static_cast<char>(bytes[0]));
+    const __m256i last = _mm256_set1_epi8(static_cast<char>(bytes[size - 1]));
+    for(; size <= n && i + size - 1 + 32 <= n; i += 32){
+        const __m256i a = _mm256_loadu_si256(static_cast<const __m256i*>(static_cast<const void*>(p + i)));
+        const __m256i b = _mm256_loadu_si256(
+                static_cast<const __m256i*>(static_cast<const void*>(p + i + size - 1)));
+        std::uint32_t m = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+                    _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last))));
+        for(; m != 0; m &= m - 1){
+            const std::size_t j = i + static_cast<std::size_t>(__builtin_ctz(m));
+            if(size < 3 || std::memcmp(p + j + 1, bytes + 1, size - 2) == 0){
+                return j;
+            }
+        }
+    }
+    return i + find_bytes_portable(p + i, n - i, bytes, mask, size);
+}
+
+// the word and the mask are repeated across a vector, which is loaded from an address
+// aligned to the word, so that each of its lanes is a word.
+static std::size_t find_word_sse2(const unsigned char* p, std::size_t n,
+        const unsigned char* bytes, const unsigned char* mask, std::size_t size)
+{
+    alignas(16) unsigned char value_bytes[16];
+    alignas(16) unsigned char mask_bytes[16];
+    for(std::size_t j = 0; j < 16; ++j){
+        value_bytes[j] = bytes[j % size];
+        mask_bytes[j] = mask[j % size];
+    }
+    const __m128i value = _mm_load_si128(static_cast<const __m128i*>(static_cast<const void*>(value_bytes)));
+    const __m128i m = _mm_load_si128(static_cast<const __m128i*>(static_cast<const void*>(mask_bytes)));
+    const std::uint32_t starts = word_starts(size, 16);
+
+    std::size_t i = (size - reinterpret_cast<std::uintptr_t>(p) % size) % size;
+    for(; i + 16 <= n; i += 16){
+        const __m128i x = _mm_and_si128(_mm_loadu_si128(
+                static_cast<const __m128i*>(static_cast<const void*>(p + i))), m);
+        const std::uint32_t equal = whole_words(
+                static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, value))), size, starts);
+        if(equal != 0){
+            return i + static_cast<std::size_t>(__builtin_ctz(equal));
+        }
+    }
+    if(n <= i){
+        return n;
+    }
+    return i + find_word_portable(p + i, n - i, bytes, mask, size);
+}
+
+__attribute__((target("avx2")))
+static std::size_t find_word_avx2(const unsigned char* p, std::size_t n,
+        const unsigned char* bytes, const unsigned char* mask, std::size_t size)
+{
+    alignas(32) unsigned char value_bytes[32];
+    alignas(32) unsigned char mask_bytes[32];
+    for(std::size_t j = 0; j < 32; ++j){
+        value_bytes[j] = bytes[j % size];
+        mask_bytes[j] = mask[j % size];
+    }
+    const __m256i value = _mm256_load_si256(
+            static_cast<const __m256i*>(static_cast<const void*>(value_bytes)));
+    const __m256i m = _mm256_load_si256(
+            static_cast<const __m256i*>(static_cast<const void*>(mask_bytes)));
+    const std::uint32_t starts = word_starts(size, 32);
+
+    std::size_t i = (size - reinterpret_cast<std::uintptr_t>(p) % size) % size;
+    for(; i + 32 <= n; i += 32){
+        const __m256i x = _mm256_and_si256(_mm256_loadu_si256(
+                static_cast<const __m256i*>(static_cast<const void*>(p + i))), m);
+        const std::uint32_t equal = whole_words(
+                static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, value))), size, starts);
+        if(equal != 0){
+            return i + static_cast<std::size_t>(__builtin_ctz(equal));
+        }
+    }
+    if(n <= i){
+        return n;
+    }
+    return i + find_word_portable(p + i, n - i, bytes, mask, size);
+}
+
+#endif
+
+needle::find_function needle::select(bool word, copy_kernel kernel)
+{
+    if(!is_supported(kernel)){
+        errno = ENOTSUP;
+        ERROR_THROW("copy kernel not supported by this cpu");
+    }
+
+    switch(kernel){
+    case copy_kernel::PORTABLE: return word ? find_word_portable : find_bytes_portable;
+#if defined(__x86_64__)
+    case copy_kernel::AUTO:
+        if(is_supported(copy_kernel::AVX2)){
+            return word ? find_word_avx2 : find_bytes_avx2;
+        }
+        return word ? find_word_sse2 : find_bytes_sse2;
+    case copy_kernel::SSE2:     return word ? find_word_sse2 : find_bytes_sse2;
+    // searching is bound by the loads, as comparing is.
+    case copy_kernel::AVX2:
+    case copy_kernel::AVX512:   return word ? find_word_avx2 : find_bytes_avx2;
+#else
+    case copy_kernel::AUTO:     return word ? find_word_portable : find_bytes_portable;
+#endif
+    default:
+        errno = EINVAL;
+        ERROR_THROW("invalid copy kernel");
+    }
+}
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
@@ -0,0 +1,43 @@
+#ifndef SEARCH_HPP_
+#define SEARCH_HPP_
+
+#include <cstddef>
+#include <string>
+#include "fwd.hpp"
+
+// what --search looks for: a string of bytes at any address, or a word of --width
+// at the addresses aligned to it, of which only the bits set in a mask are compared.
+class needle{
+public:
+    // 'spec' is "bytes:HEX", "text:STRING" or "word:VALUE[/MASK]", where a word is
+    // in --endian order. the kernel is resolved in the same way as select_copy_kernel().
+    needle(const std::string& spec, int width, endian e, copy_kernel kernel);
+
+    // the bytes a match spans.
+    std::size_t size()const{return bytes_.size();}
+    // the position of the first match which lies in [0, n) of 'data', or n if none.
+    std::size_t find(const char* data, std::size_t n)const
+    {
+        return find_(reinterpret_cast<const unsigned char*>(data), n,
+                reinterpret_cast<const unsigned char*>(bytes_.data()),
+                reinterpret_cast<const unsigned char*>(mask_.data()), bytes_.size());
+    }
+
+    // no longer than a page, so that a match spans no more than two windows.
+    static constexpr std::size_t max_size = 4096;
+
+private:
+    using find_function = std::size_t (*)(const unsigned char* data, std::size_t n,
+            const unsigned char* bytes, const unsigned char* mask, std::size_t size);
+
+    static find_function select(bool word, copy_kernel kernel);
+
+    std::string bytes_;
+    // empty for a string of bytes.
+    std::string mask_;
+    find_function find_;
+};
+
+#endif // SEARCH_HPP_
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
@@ -0,0 +1,522 @@
+#include "server.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "autotune.hpp"
+#include "common.hpp"
+#include "misc.hpp"
+#include "sighandler.hpp"
+#include "target.hpp"
+
+static struct sockaddr_un to_address(const std::string& path)
+{
+    struct sockaddr_un addr{};
+    if(sizeof(addr.sun_path) <= path.size()){
+        errno = ENAMETOOLONG;
+        ERROR_THROW(path);
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+server::server(const std::string& path, const param& prm)
+: path_(path),
+prm_(prm),
+parser_(0, nullptr),
+listen_fd_(-1),
+epoll_fd_(-1),
+event_fd_(-1),
+clients_(),
+recent_(),
+targets_()
+{
+    const struct sockaddr_un addr = to_address(path_);
+    // only a socket left by the previous run is replaced.
+    struct stat st;
+    if(lstat(path_.c_str(), &st) == 0){
+        if(!S_ISSOCK(st.st_mode)){
+            errno = EEXIST;
+            ERROR_THROW(path_ + " exists, and is not a socket");
+        }
+        unlink(path_.c_str());
+    }
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    bool failed = listen_fd_ == -1;
+    if(!failed){
+        // the socket is created accessible only to the user.
+        const mode_t mask = umask(S_IRWXG | S_IRWXO);
+        failed = bind(listen_fd_, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr)) == -1;
+        umask(mask);
+    }
+    if(failed || listen(listen_fd_, SOMAXCONN) == -1){
+        const int error = errno;
+        release();
+        errno = error;
+        ERROR_THROW(path_);
+    }
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd_;
+    failed = epoll_fd_ == -1 || event_fd_ == -1
+        || epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) == -1;
+    ev.data.fd = event_fd_;
+    failed = failed || epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev) == -1;
+    if(failed){
+        const int error = errno;
+        release();
+        errno = error;
+        ERROR_THROW("epoll/eventfd");
+    }
+
+    // measured here, if it has to be, rather than in the first request.
+    if(prm_.auto_jobs){
+        calibration::get(prm_);
+    }
+}
+
+server::~server()
+{
+    release();
+}
+
+void server::release()
+{
+    for(const auto& [fd, c]: clients_){
+        close_client(c);
+    }
+    clients_.clear();
+    for(int* fd: {&event_fd_, &epoll_fd_}){
+        if(0 <= *fd){
+            close(*fd);
+            *fd = -1;
+        }
+    }
+    if(0 <= listen_fd_){
+        close(listen_fd_);
+        listen_fd_ = -1;
+        unlink(path_.c_str());
+    }
+}
+
+int server::run()
+{
+    struct epoll_event events[64];
+    while(!stop_requested()){
+        const int n = epoll_wait(epoll_fd_, events, sizeof(events) / sizeof(events[0]), -1);
+        if(n == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            ERROR("epoll_wait");
+        }
+
+        for(int i = 0; i < n; ++i){
+            const int fd = events[i].data.fd;
+            if(fd == event_fd_){
+                return 0;
+            }
+            if(fd == listen_fd_){
+                accept_clients();
+                continue;
+            }
+
+            auto it = clients_.find(fd);
+            if(it == clients_.end()){
+                continue;
+            }
+            client& c = it->second;
+            bool alive = true;
+            if(!c.closing && c.in.size() < max_buffered
+                    && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))){
+                alive = receive(c);
+            }
+            // the requests are served as long as the replies are taken.
+            while(alive){
+                alive = serve(c);
+                if(!alive || is_idle(c)){
+                    break;
+                }
+                alive = send(c);
+                if(!is_idle(c)){
+                    break;
+                }
+            }
+            // a client which has finished sending is closed once it has got all the replies.
+            if(alive && c.closing && c.in.empty() && is_idle(c)){
+                alive = false;
+            }
+            if(alive){
+                watch(c);
+            }else{
+                close_client(c);
+                clients_.erase(it);
+            }
+        }
+    }
+    return 0;
+}
+
+void server::stop()
+{
+    const std::uint64_t one = 1;
+    if(write(event_fd_, &one, sizeof(one)) == -1){
+        WARN(std::string("eventfd: ") + std::strerror(errno));
+    }
+}
+
+void server::accept_clients()
+{
+    while(true){
+        const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd == -1){
+            if(errno != EAGAIN && errno != EINTR){
+                WARN(std::string("accept: ") + std::strerror(errno));
+            }
+            return;
+        }
+
+        // even if the socket has been made accessible to others since.
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1
+                || (cred.uid != geteuid() && cred.uid != 0)){
+            WARN("a client of another user is refused.");
+            close(fd);
+            continue;
+        }
+
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if(epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == -1){
+            WARN(std::string("epoll_ctl: ") + std::strerror(errno));
+            close(fd);
+            continue;
+        }
+        clients_[fd] = client{fd, std::string(), std::string(), 0, -1, 0, 0, false};
+    }
+}
+
+void server::close_client(const client& c)
+{
+    close(c.fd);
+    if(0 <= c.memfd){
+        close(c.memfd);
+    }
+}
+
+bool server::receive(client& c)
+{
+    char buf[4096];
+    while(c.in.size() < max_buffered){
+        const ssize_t ret = read(c.fd, buf, sizeof(buf));
+        if(ret == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            return errno == EAGAIN;
+        }
+        if(ret == 0){
+            c.closing = true;
+            break;
+        }
+        c.in.append(buf, static_cast<std::size_t>(ret));
+    }
+    return true;
+}
+
+bool server::serve(client& c)
+{
+    // the requests are served as soon as their lines are complete, until the replies
+    // kept reach the bound. the data of DST "-" has to be sent before the next one.
+    std::size_t pos = 0;
+    while(c.out.size() < max_buffered && c.data_left == 0){
+        const std::size_t end = c.in.find('\n', pos);
+        if(end == std::string::npos){
+            // the last request may lack its newline.
+            if(c.closing && pos < c.in.size()){
+                c.out += execute(c.in.substr(pos), c);
+                pos = c.in.size();
+            }
+            break;
+        }
+        const std::string spec = c.in.substr(pos, end - pos);
+        pos = end + 1;
+        if(!spec.empty()){
+            c.out += execute(spec, c);
+        }
+    }
+    c.in.erase(0, pos);
+
+    // a line which doesn't fit is not a request.
+    if(max_buffered <= c.in.size() && c.in.find('\n') == std::string::npos){
+        WARN("a client has sent too long a line.");
+        return false;
+    }
+    return true;
+}
+
+bool server::send(client& c)
+{
+    while(c.sent < c.out.size()){
+        const ssize_t ret = ::send(c.fd, c.out.data() + c.sent, c.out.size() - c.sent, MSG_NOSIGNAL);
+        if(ret == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            return errno == EAGAIN;
+        }
+        c.sent += static_cast<std::size_t>(ret);
+    }
+    c.out.clear();
+    c.sent = 0;
+
+    // the data goes from the memfd in pieces, as far as the socket takes it.
+    while(0 < c.data_left){
+        const ssize_t ret = sendfile(c.fd, c.memfd, &c.data_pos, c.data_left);
+        if(ret == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            return errno == EAGAIN;
+        }
+        if(ret == 0){
+            return false;
+        }
+        c.data_left -= static_cast<std::size_t>(ret);
+        if(c.data_left == 0 && ftruncate(c.memfd, 0) == -1){
+            WARN(std::string("ftruncate: ") + std::strerror(errno));
+        }
+    }
+    return true;
+}
+
+void server::watch(const client& c)
+{
+    // a client is not read from while its requests or its replies kept reach the bound.
+    // one which has finished sending is only waited for to take the replies.
+    struct epoll_event ev{};
+    if(!is_idle(c)){
+        ev.events |= EPOLLOUT;
+    }
+    if(!c.closing && c.in.size() < max_buffered && c.out.size() < max_buffered){
+        ev.events |= EPOLLIN;
+    }
+    ev.data.fd = c.fd;
+    if(epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c.fd, &ev) == -1){
+        WARN(std::string("epoll_ctl: ") + std::strerror(errno));
+    }
+}
+
+std::string server::execute(const std::string& spec, client& c)
+{
+    try{
+        std::string src_spec, dst_spec;
+        bool compare;
+        parser_.parse_transfer(spec, src_spec, dst_spec, compare);
+        if(src_spec == "-"){
+            return "ERR stdin is not available: " + spec + '\n';
+        }
+        const std::shared_ptr<target> src = lookup(src_spec, target_role::SRC);
+
+        // only whether they differ is replied.
+        if(compare){
+            const std::shared_ptr<target> ref = lookup(dst_spec, target_role::SRC);
+            const int ret = src->compile_compare(*ref, prm_, -1)();
+            return ret == 0 ? std::string("OK 0\n")
+                : std::string("ERR ") + (ret == target::differ ? "differ" : std::strerror(ret))
+                    + ": " + spec + '\n';
+        }
+
+        if(dst_spec != "-"){
+            const std::shared_ptr<target> dst = lookup(dst_spec, target_role::DST);
+            const int ret = src->transfer_to(*dst, prm_);
+            return ret == 0 ? std::string("OK 0\n")
+                : std::string("ERR ") + std::strerror(ret) + ": " + spec + '\n';
+        }
+
+        // DST "-" is captured, and sent back after the reply line.
+        // a memfd of each client holds it until it's sent.
+        if(c.memfd == -1){
+            c.memfd = memfd_create("masterkey", MFD_CLOEXEC);
+        }
+        if(c.memfd == -1 || ftruncate(c.memfd, 0) == -1 || lseek(c.memfd, 0, SEEK_SET) == -1){
+            ERROR_THROW("memfd");
+        }
+        const int ret = src->transfer_to(target(c.memfd), prm_);
+        if(ret != 0){
+            return std::string("ERR ") + std::strerror(ret) + ": " + spec + '\n';
+        }
+
+        struct stat buf;
+        if(fstat(c.memfd, &buf) == -1){
+            ERROR_THROW("fstat");
+        }
+        c.data_pos = 0;
+        c.data_left = static_cast<std::size_t>(buf.st_size);
+        return "OK " + std::to_string(c.data_left) + '\n';
+    }catch(const std::exception& e){
+        return std::string("ERR ") + e.what() + ": " + spec + '\n';
+    }
+}
+
+std::shared_ptr<target> server::lookup(const std::string& spec, target_role role)
+{
+    // paths are opened for each request, as they are from the command line.
+    // e.g. a destination file is truncated each time.
+    if(!option_parser::is_range(spec)){
+        return parser_.to_target(spec, role, prm_);
+    }
+
+    const target_key k(role, spec);
+    const auto it = targets_.find(k);
+    if(it != targets_.end()){
+        recent_.splice(recent_.begin(), recent_, it->second.second);
+        return it->second.first;
+    }
+
+    const std::shared_ptr<target> t = parser_.to_target(spec, role, prm_);
+    if(max_targets <= targets_.size()){
+        // unmapped here, unless a request in progress still uses it.
+        targets_.erase(recent_.back());
+        recent_.pop_back();
+    }
+    recent_.push_front(k);
+    targets_.emplace(k, std::make_pair(t, recent_.begin()));
+    return t;
+}
+
+int request(const std::string& path, const std::vector<std::string>& specs, int out)
+{
+    const struct sockaddr_un addr = to_address(path);
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd == -1){
+        ERROR("socket");
+    }
+    const std::shared_ptr<int> closer(new int(fd), [](int* p){close(*p); delete p;});
+    if(connect(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr)) == -1){
+        ERROR(path);
+    }
+
+    // the requests are sent as far as the socket takes them, while the replies are read,
+    // since the server stops reading a client which doesn't take its replies.
+    if(fcntl(fd, F_SETFL, O_NONBLOCK) == -1){
+        ERROR("fcntl");
+    }
+    std::string requests;
+    for(const std::string& spec: specs){
+        requests += spec + '\n';
+    }
+    std::size_t sent = 0;
+    bool shut = false;
+
+    int result = 0;
+    std::string in;
+    std::size_t replies = 0;
+    std::size_t pending = 0; // the bytes of data yet to be written to 'out'.
+    char buf[65536];
+    while(replies < specs.size() || 0 < pending){
+        if(sent == requests.size() && !shut){
+            if(shutdown(fd, SHUT_WR) == -1){
+                ERROR("shutdown");
+            }
+            shut = true;
+        }
+
+        struct pollfd pfd{};
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if(sent < requests.size()){
+            pfd.events |= POLLOUT;
+        }
+        if(poll(&pfd, 1, -1) == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            ERROR("poll");
+        }
+
+        while((pfd.revents & POLLOUT) && sent < requests.size()){
+            const ssize_t ret = ::send(fd, requests.data() + sent, requests.size() - sent, MSG_NOSIGNAL);
+            if(ret == -1){
+                if(errno == EINTR){
+                    continue;
+                }
+                if(errno == EAGAIN){
+                    break;
+                }
+                ERROR("send");
+            }
+            sent += static_cast<std::size_t>(ret);
+        }
+        if(!(pfd.revents & (POLLIN | POLLHUP | POLLERR))){
+            continue;
+        }
+
+        ssize_t ret = read(fd, buf, sizeof(buf));
+        if(ret == -1){
+            if(errno == EINTR || errno == EAGAIN){
+                continue;
+            }
+            ERROR("read");
+        }
+        if(ret == 0){
+            errno = ECONNRESET;
+            ERROR("the server has closed the connection");
+        }
+        in.append(buf, static_cast<std::size_t>(ret));
+
+        std::size_t pos = 0;
+        while(pos < in.size()){
+            if(0 < pending){
+                const std::size_t n = std::min(pending, in.size() - pos);
+                for(std::size_t done = 0; done < n;){
+                    const ssize_t w = write(out, in.data() + pos + done, n - done);
+                    if(w == -1){
+                        if(errno == EINTR){
+                            continue;
+                        }
+                        ERROR("write");
+                    }
+                    done += static_cast<std::size_t>(w);
+                }
+                pos += n;
+                pending -= n;
+                continue;
+            }
+
+            const std::size_t end = in.find('\n', pos);
+            if(end == std::string::npos){
+                break;
+            }
+            const std::string line = in.substr(pos, end - pos);
+            pos = end + 1;
+            ++replies;
+            if(line.compare(0, 3, "OK ") == 0){
+                pending = std::stoul(line.substr(3));
+            }else{
+                std::cerr << progname << ": " << line << std::endl;
+                result = EIO;
+            }
+        }
+        in.erase(0, pos);
+    }
+    return result;
+}
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
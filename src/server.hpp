@@ -0,0 +1,87 @@
+#ifndef SERVER_HPP_
+#define SERVER_HPP_
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "fwd.hpp"
+#include "option.hpp"
+
+// serves TRANSFERs sent over a unix domain socket, one per line, to any number of clients.
+// ranges stay mapped between the requests, so that each of them costs no more than the copy.
+// a request is replied with a line of "OK LENGTH", followed by LENGTH bytes written to
+// DST "-", or a line of "ERR MESSAGE". the replies come in the order of the requests.
+// only the user running the server, and root, may connect, since the transfers touch
+// whatever the server can. a client which doesn't take its replies is not read from
+// any further, so that they don't pile up in the server.
+class server{
+public:
+    // listens on 'path', replacing the socket left there, if any. anything else
+    // there is left as it is, and fails. the socket is accessible only to the user.
+    // the transfers follow 'prm', e.g. --hexdump or --device.
+    server(const std::string& path, const param& prm);
+    server(const server&) = delete;
+    server& operator=(const server&) = delete;
+    ~server();
+
+    // serves until stop() is called, or stop_requested() gets true.
+    int run();
+    // lets run() return. this can be called from any thread.
+    void stop();
+
+private:
+    struct client{
+        int fd;
+        std::string in;
+        std::string out;
+        std::size_t sent;
+        // captures what is written to DST "-", which is sent after 'out'
+        // from 'data_pos' on, 'data_left' bytes more.
+        int memfd;
+        off_t data_pos;
+        std::size_t data_left;
+        // the client has finished sending requests.
+        bool closing;
+    };
+
+    // the bytes of requests and of replies kept for a client at most.
+    static constexpr std::size_t max_buffered = 1ul << 20;
+
+    void release();
+    void accept_clients();
+    void close_client(const client& c);
+    // these return false when the client has gone, or is to be dropped.
+    bool receive(client& c);
+    bool serve(client& c);
+    bool send(client& c);
+    void watch(const client& c);
+    static bool is_idle(const client& c){return c.out.empty() && c.data_left == 0;}
+    // returns the reply line. the data written to DST "-", if any, is left in 'c.memfd'.
+    std::string execute(const std::string& spec, client& c);
+    std::shared_ptr<target> lookup(const std::string& spec, target_role role);
+
+    const std::string path_;
+    const param& prm_;
+    const option_parser parser_;
+    int listen_fd_;
+    int epoll_fd_;
+    int event_fd_;
+    std::map<int, client> clients_;
+    // mapped ranges, keyed by the role and the spec, the least recently used of which
+    // is dropped beyond max_targets, so that scanning clients don't exhaust the mappings.
+    using target_key = std::pair<target_role, std::string>;
+    static constexpr std::size_t max_targets = 1024;
+    std::list<target_key> recent_; // the most recently used first.
+    std::map<target_key, std::pair<std::shared_ptr<target>, std::list<target_key>::iterator>> targets_;
+};
+
+// sends 'specs' to the server at 'path', and writes the data replied to 'out'.
+// the replies are read while the requests are sent, so that any number of them fit.
+// returns 0 if all of them have succeeded.
+int request(const std::string& path, const std::vector<std::string>& specs, int out);
+
+#endif // SERVER_HPP_
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
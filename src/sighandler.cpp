@@ -1,10 +1,15 @@
 #include "sighandler.hpp"
 
+#include <cstring>
 #include <signal.h>
 #include <unistd.h>
 #include "misc.hpp"
 
 static void sigbus_handler(int, siginfo_t* siginfo, void *);
+static void repeat_handler(int signum);
+
+static volatile sig_atomic_t report_requested = 0;
+static volatile sig_atomic_t stop_requested_ = 0;
 
 void set_signal_handler(void)
 {
@@ -17,10 +22,53 @@ void set_signal_handler(void)
     }
 }
 
+void set_repeat_signal_handler(void)
+{
+    struct sigaction act{};
+    act.sa_handler = repeat_handler;
+    act.sa_flags = SA_RESTART;
+
+    for(int signum: {SIGUSR1, SIGINT, SIGTERM}){
+        if(sigaction(signum, &act, nullptr) == -1){
+            ERROR_THROW(std::string("sigaction: ") + strsignal(signum));
+        }
+    }
+}
+
+bool take_report_request(void)
+{
+    if(!report_requested){
+        return false;
+    }
+    report_requested = 0;
+    return true;
+}
+
+bool stop_requested(void)
+{
+    return stop_requested_;
+}
+
 void sigbus_handler(int, siginfo_t* siginfo, void *)
 {
     psiginfo(siginfo, progname);
     _exit(EXIT_FAILURE);
 }
 
+void repeat_handler(int signum)
+{
+    if(signum == SIGUSR1){
+        report_requested = 1;
+        return;
+    }
+
+    // e.g. stuck in reading a pipe, the loop can't see the request.
+    if(stop_requested_){
+        signal(signum, SIG_DFL);
+        raise(signum);
+        return;
+    }
+    stop_requested_ = 1;
+}
+
 // vim: set expandtab shiftwidth=0 tabstop=4 :
@@ -3,6 +3,13 @@
 
 void set_signal_handler(void);
 
+// lets SIGUSR1 request a report, and SIGINT and SIGTERM request the repeat loop,
+// or the server, to stop after the current iteration. the second SIGINT or SIGTERM terminates at once.
+void set_repeat_signal_handler(void);
+// returns true once for each request made since the last call.
+bool take_report_request(void);
+bool stop_requested(void);
+
 #endif // SIGHANDLER_HPP_
 
 // vim: set expandtab shiftwidth=0 tabstop=4 :
@@ -0,0 +1,111 @@
+#include "stats.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include "misc.hpp"
+
+int stats::fd_ = -1;
+stats_format stats::format_ = stats_format::JSON;
+bool stats::header_written_ = false;
+std::atomic<std::uint64_t> stats::times_[stats::phases] = {};
+std::atomic<std::uint64_t> stats::bytes_(0);
+std::atomic<std::uint64_t> stats::syscalls_(0);
+std::atomic<std::uint64_t> stats::threads_(0);
+
+static const char* const phase_names[] = {
+    "open_ns", "fstat_ns", "mmap_ns", "copy_ns", "msync_ns", "fsync_ns",
+};
+
+void stats::enable(const std::string& spec)
+{
+    const std::size_t colon = spec.find(':');
+    const std::string format = spec.substr(0, colon);
+    if(format == "json"){
+        format_ = stats_format::JSON;
+    }else if(format == "csv"){
+        format_ = stats_format::CSV;
+    }else{
+        errno = EINVAL;
+        ERROR_THROW("invalid stats format: '" + format + "'");
+    }
+
+    int fd = STDERR_FILENO;
+    if(colon != std::string::npos){
+        std::size_t idx = 0;
+        try{
+            fd = std::stoi(spec.substr(colon + 1), &idx, 0);
+        }catch(const std::exception& e){
+            idx = 0;
+        }
+        if(idx == 0 || idx != spec.size() - colon - 1 || fd < 0){
+            errno = EINVAL;
+            ERROR_THROW("can't convert to file descriptor: '" + spec.substr(colon + 1) + "'");
+        }
+    }
+    if(fcntl(fd, F_GETFD) == -1){
+        ERROR_THROW("stats: " + std::to_string(fd));
+    }
+
+    fd_ = fd;
+    header_written_ = false;
+    for(auto& t: times_){
+        t = 0;
+    }
+    bytes_ = 0;
+    syscalls_ = 0;
+    threads_ = 0;
+}
+
+void stats::emit(const char* stage, long repeat, long transfer)
+{
+    if(!enabled()){
+        return;
+    }
+
+    const bool json = format_ == stats_format::JSON;
+    std::string record;
+
+    if(!json && !header_written_){
+        record += "stage,repeat,transfer";
+        for(const char* name: phase_names){
+            record += std::string(",") + name;
+        }
+        record += ",bytes,syscalls,threads\n";
+        header_written_ = true;
+    }
+
+    const auto field = [&](const char* name, std::uint64_t value, bool valid){
+        if(json){
+            record += std::string(", \"") + name + "\": ";
+            record += valid ? std::to_string(value) : "null";
+        }else{
+            record += ',';
+            record += valid ? std::to_string(value) : "";
+        }
+    };
+
+    record += json ? std::string("{\"stage\": \"") + stage + '"' : std::string(stage);
+    field("repeat", static_cast<std::uint64_t>(repeat), 0 <= repeat);
+    field("transfer", static_cast<std::uint64_t>(transfer), 0 <= transfer);
+    for(std::size_t i = 0; i < phases; ++i){
+        field(phase_names[i], times_[i].exchange(0), true);
+    }
+    field("bytes", bytes_.exchange(0), true);
+    field("syscalls", syscalls_.exchange(0), true);
+    field("threads", threads_.exchange(0), true);
+    record += json ? "}\n" : "\n";
+
+    for(std::size_t done = 0; done < record.size();){
+        const ssize_t ret = ::write(fd_, record.data() + done, record.size() - done);
+        if(ret == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            WARN(std::string("stats: ") + std::strerror(errno));
+            return;
+        }
+        done += static_cast<std::size_t>(ret);
+    }
+}
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
@@ -0,0 +1,101 @@
+#ifndef STATS_HPP_
+#define STATS_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// the phases of a transfer, which are timed separately.
+enum class phase{
+    OPEN,
+    FSTAT,
+    MMAP,
+    COPY,
+    MSYNC,
+    FSYNC,
+};
+
+enum class stats_format{
+    JSON,
+    CSV,
+};
+
+// timers of each phase and counters of bytes, system calls and threads,
+// accumulated by all the threads until emit() writes them out as a record.
+// while disabled, which is the default, each of the calls below is a single branch.
+class stats{
+    using clock = std::chrono::steady_clock;
+
+public:
+    // 'spec' is FORMAT[:FD], where FORMAT is either of json, csv.
+    // records are written to FD, by default, 2.
+    static void enable(const std::string& spec);
+    static void disable(){fd_ = -1;}
+    static bool enabled(){return fd_ != -1;}
+
+    static void add_bytes(std::size_t n)
+    {
+        if(enabled()){
+            bytes_.fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    static void add_syscall()
+    {
+        if(enabled()){
+            syscalls_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // records that 'n' threads worked at once, keeping the largest.
+    static void add_threads(std::size_t n)
+    {
+        if(enabled()){
+            for(std::uint64_t t = threads_; t < n && !threads_.compare_exchange_weak(t, n);){}
+        }
+    }
+
+    // writes out what has been accumulated since the last call as a record, and resets it.
+    // a JSON record is an object on a line. CSV records follow a header line.
+    // 'repeat' and 'transfer' count from 0, and are left empty if negative.
+    static void emit(const char* stage, long repeat, long transfer);
+
+    // times a phase from its construction to its destruction.
+    // phases run by several threads at once, e.g. windows mapped in the background
+    // while the current one is copied, are summed up, so they may exceed the wall time.
+    class timer{
+    public:
+        explicit timer(phase p): phase_(p), start_(enabled() ? clock::now() : clock::time_point()){}
+        timer(const timer&) = delete;
+        timer& operator=(const timer&) = delete;
+        ~timer()
+        {
+            if(enabled()){
+                times_[static_cast<std::size_t>(phase_)].fetch_add(static_cast<std::uint64_t>(
+                            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                clock::now() - start_).count()), std::memory_order_relaxed);
+            }
+        }
+
+    private:
+        const phase phase_;
+        const clock::time_point start_;
+    };
+
+private:
+    static constexpr std::size_t phases = static_cast<std::size_t>(phase::FSYNC) + 1;
+
+    static int fd_;
+    static stats_format format_;
+    static bool header_written_;
+    static std::atomic<std::uint64_t> times_[phases];
+    static std::atomic<std::uint64_t> bytes_;
+    static std::atomic<std::uint64_t> syscalls_;
+    static std::atomic<std::uint64_t> threads_;
+};
+
+#endif // STATS_HPP_
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
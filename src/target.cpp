@@ -1,13 +1,34 @@
 #include "target.hpp"
-#include <cctype>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstdio>
-#include <thread>
+#include <future>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <vector>
+#include <cinttypes>
+#include <climits>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include "autotune.hpp"
+#include "checksum.hpp"
 #include "common.hpp"
+#include "copykernel.hpp"
+#include "hexdump.hpp"
 #include "misc.hpp"
+#include "pattern.hpp"
 #include "sched.hpp"
+#include "search.hpp"
 #include "sighandler.hpp"
+#include "stats.hpp"
+#include "uring.hpp"
+#include "workerpool.hpp"
 
 endian to_endian(const std::string& str)
 {
@@ -23,17 +44,47 @@ endian to_endian(const std::string& str)
     }
 }
 
+sync_mode to_sync_mode(const std::string& str)
+{
+    if(str == "full"){
+        return sync_mode::FULL;
+    }else if(str == "data"){
+        return sync_mode::DATA;
+    }else if(str == "none"){
+        return sync_mode::NONE;
+    }else{
+        errno = EINVAL;
+        ERROR_THROW("invalid sync mode");
+    }
+}
+
 const long target::page_size_ = sysconf(_SC_PAGESIZE);
 
 target::target(const std::string& filename, target_role role,
-        std::size_t offset, std::size_t length)
-: ptr_to_fd_(new int(iohelper::open(filename.c_str(), select_file_flags(role),
-                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)), iohelper::close),
+        std::size_t offset, std::size_t length, const mapping_policy& policy)
+: target(std::shared_ptr<int>(new int(iohelper::open(filename.c_str(), select_file_flags(role),
+                    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)), iohelper::close),
+        filename, role, offset, length, policy, nullptr)
+{}
+
+target::target(device_cache& cache, const std::string& filename, target_role role,
+        std::size_t offset, std::size_t length, const mapping_policy& policy)
+: target(cache.open(filename, role), filename, role, offset, length, policy, &cache)
+{}
+
+target::target(const std::shared_ptr<int>& fd, const std::string& filename, target_role role,
+        std::size_t offset, std::size_t length, const mapping_policy& policy,
+        device_cache* cache)
+: ptr_to_fd_(fd),
 mmapped_data_(),
 stat_(iohelper::fstat(*ptr_to_fd_)),
 offset_(offset),
 length_(init_length(length, role)),
-page_offset_(offset_ & (static_cast<std::size_t>(page_size_) - 1))
+page_offset_(offset_ & (static_cast<std::size_t>(page_size_) - 1)),
+policy_(policy),
+window_((policy.window + static_cast<std::size_t>(page_size_) - 1) & ~(static_cast<std::size_t>(page_size_) - 1)),
+prot_(),
+pattern_()
 {
     if(*ptr_to_fd_ == -1){
         ERROR_THROW(filename);
@@ -49,14 +100,22 @@ page_offset_(offset_ & (static_cast<std::size_t>(page_size_) - 1))
         return;
     }
 
-    int prot = 0;
     switch(role){
-    case target_role::SRC: prot = PROT_READ;  break;
-    case target_role::DST: prot = PROT_WRITE; break;
+    case target_role::SRC: prot_ = PROT_READ;  break;
+    case target_role::DST: prot_ = PROT_WRITE; break;
     default: ERROR_THROW(""); break;
     }
 
-    mmap(prot);
+    if(0 < window_ && window_ < page_offset_ + length_){
+        return;
+    }
+
+    if(cache){
+        mmapped_data_ = cache->map(device_cache::key(filename, role), *ptr_to_fd_, prot_,
+                offset_, length_, is_regular_file(), policy_);
+        return;
+    }
+    mmap(prot_);
 }
 
 target::target(int fd)
@@ -65,70 +124,474 @@ mmapped_data_(),
 stat_(iohelper::fstat(*ptr_to_fd_)),
 offset_(),
 length_(),
-page_offset_()
+page_offset_(),
+policy_(),
+window_(),
+prot_(),
+pattern_()
+{}
+
+target::target(const pattern& p)
+: ptr_to_fd_(std::make_shared<int>(-1)),
+mmapped_data_(),
+stat_(),
+offset_(),
+length_(),
+page_offset_(),
+policy_(),
+window_(),
+prot_(),
+pattern_(std::make_shared<const pattern>(p))
 {}
 
 int target::transfer_to(const target& dest, const param& prm)const
 {
-    stopwatch sw(std::string(__func__) + ": ", prm.verbose);
+    return compile(dest, prm)();
+}
+
+std::function<int()> target::compile(const target& dest, const param& prm)const
+{
     set_scheduling_policy(prm.scheduling_policy);
     set_signal_handler();
 
-    if(iohelper::lseek(*ptr_to_fd_, 0, SEEK_SET) == -1){
-        ERROR("lseek");
+    if(dest.mmapped_data_ && 0 <= prm.numa_node){
+        if(bind_to_numa_node(dest.mmapped_data_.get(), dest.page_offset_ + dest.length_,
+                    prm.numa_node) == -1){
+            WARN(std::string("mbind: ") + std::strerror(errno));
+        }
     }
 
-    const std::size_t jobs = static_cast<std::size_t>(prm.jobs);
+    // only regular files and block devices have anything to synchronize, which /dev/mem,
+    // a terminal or a pipe don't. it's told by the type, without trying.
+    const sync_mode sync = S_ISREG(dest.stat_.st_mode) || S_ISBLK(dest.stat_.st_mode)
+        ? prm.sync : sync_mode::NONE;
+    const bool sync_windows = sync != sync_mode::NONE;
+
+    // moves the data, and returns the bytes written to the mapped destination through 'written'.
+    // what is moved is appended to 'sum', if any, which is reset before each move.
+    std::function<int(std::size_t& written)> move;
+    std::shared_ptr<checksum> sum;
+    if(prm.checksum != checksum_algorithm::NONE){
+        sum = std::make_shared<checksum>(prm.checksum);
+    }
 
-    if(mmapped_data_){
-        if(dest.mmapped_data_){
-            iohelper::memcpy(dest.offset(), offset(), std::min(length_, dest.length_),
-                    prm.scheduling_policy, jobs);
-        }else if(prm.hexdump_enabled){
-            if(hexdump(*dest.ptr_to_fd_, mmapped_data_.get(),
-                        offset_, length_, page_offset_, prm) != 0){
-                ERROR("hexdump");
+    if(pattern_ && !dest.is_mapped()){
+        errno = EINVAL;
+        ERROR_THROW("a pattern needs a range to fill");
+    }
+
+    // a pattern is generated into the destination window by window on the jobs.
+    // a few registers are peeked or poked at --width on the spot.
+    // what is read is formatted on the stack, and written out at once.
+    if(pattern_ && dest.is_register()){
+        move = [this, &dest, &prm, sum](std::size_t& written){
+            written = dest.length_;
+            alignas(std::uint64_t) char image[max_register_size + sizeof(std::uint64_t)];
+            char* const regs = image + (dest.page_offset_ & (sizeof(std::uint64_t) - 1));
+            pattern_->generate(regs, 0, written);
+            if(sum){
+                sum->update(regs, written);
             }
-        }else{
-            if(write_to(dest, prm) != 0){
-                ERROR("write_to");
+            iohelper::copy_registers(dest.mmapped_data_.get() + dest.page_offset_, regs, written, prm.width);
+            return 0;
+        };
+    }else if(pattern_){
+        move = [this, &dest, &prm, sum, sync_windows](std::size_t& written){
+            written = dest.length_;
+            return stream(nullptr, &dest, written,
+                    [this, &prm, &sum](std::size_t pos, std::size_t n, const char*, char* d){
+                        iohelper::fill(d, *pattern_, pos, n, prm, sum.get());
+                        return 0;
+                    }, sync_windows);
+        };
+    }else if(is_register() && dest.is_register()){
+        move = [this, &dest, &prm, sum](std::size_t& written){
+            written = std::min(length_, dest.length_);
+            char* const d = dest.mmapped_data_.get() + dest.page_offset_;
+            const char* const s = mmapped_data_.get() + page_offset_;
+            if(!sum){
+                iohelper::copy_registers(d, s, written, prm.width);
+                return 0;
             }
-        }
-    }else{
-        if(dest.mmapped_data_){
-            ssize_t ret;
-            std::size_t count = 0ul;
-            while((ret = iohelper::read(*ptr_to_fd_, dest.offset() + count, dest.length_ - count)) != 0){
+            // the registers are read once, into an image which is summed on the way.
+            alignas(std::uint64_t) char image[max_register_size + sizeof(std::uint64_t)];
+            char* const regs = image + (page_offset_ & (sizeof(std::uint64_t) - 1));
+            iohelper::copy_registers(regs, s, written, prm.width);
+            sum->update(regs, written);
+            iohelper::copy_registers(d, regs, written, prm.width);
+            return 0;
+        };
+    }else if(is_register() && !dest.is_mapped() && !dest.is_regular_file()){
+        move = [this, &dest, &prm, sum](std::size_t&){
+            // the image shares the alignment of the registers, to be loaded at the same width.
+            alignas(std::uint64_t) char image[max_register_size + sizeof(std::uint64_t)];
+            char* const regs = image + (page_offset_ & (sizeof(std::uint64_t) - 1));
+            iohelper::copy_registers(regs, mmapped_data_.get() + page_offset_, length_, prm.width);
+            if(sum){
+                sum->update(regs, length_);
+            }
+
+            if(!prm.hexdump_enabled){
+                if(iohelper::write(*dest.ptr_to_fd_, regs, length_) == -1){
+                    ERROR("write");
+                }
+                stats::add_bytes(length_);
+                return 0;
+            }
+
+            hexdump_formatter formatter(nullptr, offset_, length_, page_offset_,
+                    prm.width, prm.endianness);
+            formatter.rebase(regs, page_offset_);
+            char out[hexdump_formatter::max_header_size
+                + (max_register_size / 16 + 2) * hexdump_formatter::max_line_size];
+            std::size_t len = formatter.header(out);
+            len += formatter.format(out + len, 0, formatter.lines());
+            if(iohelper::write(*dest.ptr_to_fd_, out, len) == -1){
+                ERROR("write");
+            }
+            stats::add_bytes(length_);
+            return 0;
+        };
+    }else if(!is_mapped() && dest.is_register()){
+        move = [this, &dest, &prm, sum](std::size_t& written){
+            if(iohelper::lseek(*ptr_to_fd_, 0, SEEK_SET) == -1){
+                ERROR("lseek");
+            }
+            alignas(std::uint64_t) char image[max_register_size + sizeof(std::uint64_t)];
+            char* const regs = image + (dest.page_offset_ & (sizeof(std::uint64_t) - 1));
+            while(written < dest.length_){
+                const ssize_t ret = iohelper::read(*ptr_to_fd_, regs + written, dest.length_ - written);
                 if(ret == -1){
                     ERROR("read");
                 }
-                count += static_cast<std::size_t>(ret);
+                if(ret == 0){
+                    break;
+                }
+                written += static_cast<std::size_t>(ret);
             }
-        }else{
-            if(passthrough(dest) != 0){
-                ERROR("passthrough");
+            if(sum){
+                sum->update(regs, written);
             }
+            iohelper::copy_registers(dest.mmapped_data_.get() + dest.page_offset_, regs, written, prm.width);
+            return 0;
+        };
+    }else if(is_mapped()){
+        if(dest.is_mapped()){
+            move = [this, &dest, &prm, sum, sync_windows](std::size_t& written){
+                written = std::min(length_, dest.length_);
+                return stream(this, &dest, written,
+                        [&prm, &sum](std::size_t, std::size_t n, const char* s, char* d){
+                            iohelper::memcpy(d, s, n, prm, sum.get());
+                            return 0;
+                        }, sync_windows);
+            };
+        }else if(prm.hexdump_enabled){
+            move = [this, &dest, &prm, sum](std::size_t&){
+                if(hexdump(dest, prm, sum.get()) != 0){
+                    ERROR("hexdump");
+                }
+                stats::add_bytes(length_);
+                return 0;
+            };
+        }else{
+            const bool lend = is_stable(prm);
+            move = [this, &dest, &prm, sum, lend](std::size_t&){
+                if(write_to(dest, prm, sum.get(), lend) != 0){
+                    ERROR("write_to");
+                }
+                stats::add_bytes(length_);
+                return 0;
+            };
+        }
+    }else{
+        if(dest.is_mapped()){
+            move = [this, &dest, sum, sync_windows](std::size_t& written){
+                if(iohelper::lseek(*ptr_to_fd_, 0, SEEK_SET) == -1){
+                    ERROR("lseek");
+                }
+                const int status = stream(nullptr, &dest, dest.length_,
+                        [this, &written, &sum](std::size_t, std::size_t n, const char*, char* d){
+                            std::size_t count = 0ul;
+                            while(count < n){
+                                const ssize_t ret = iohelper::read(*ptr_to_fd_, d + count, n - count);
+                                if(ret == -1){
+                                    ERROR("read");
+                                }
+                                if(ret == 0){
+                                    return EOF;
+                                }
+                                if(sum){
+                                    sum->update(d + count, static_cast<std::size_t>(ret));
+                                }
+                                count += static_cast<std::size_t>(ret);
+                                written += static_cast<std::size_t>(ret);
+                            }
+                            return 0;
+                        }, sync_windows);
+                return status == EOF ? 0 : status;
+            };
+        }else{
+            move = [this, &dest, &prm, sum](std::size_t&){
+                if(iohelper::lseek(*ptr_to_fd_, 0, SEEK_SET) == -1){
+                    ERROR("lseek");
+                }
+                if(passthrough(dest, prm, sum.get()) != 0){
+                    ERROR("passthrough");
+                }
+                return 0;
+            };
         }
     }
 
-    if(dest.mmapped_data_){
-        if(msync(mmapped_data_.get(), page_offset_ + length_, MS_SYNC) == -1){
-            ERROR("msync");
+    const bool verbose = prm.verbose;
+
+    return [this, &dest, &prm, move, sum, sync, verbose]{
+        const cpu_affinity_scope pinned(prm.cpus);
+        std::optional<stopwatch> sw;
+        if(verbose){
+            sw.emplace("transfer_to: ");
         }
-    }
-    if(fsync(*dest.ptr_to_fd_) == -1){
-        if(errno != EROFS && errno != EINVAL){
-            ERROR("fsync");
+        stats::add_threads(1);
+
+        std::size_t written = 0ul;
+        {
+            stats::timer t(phase::COPY);
+            if(sum){
+                sum->reset();
+            }
+            const int ret = move(written);
+            if(ret != 0){
+                return ret;
+            }
+            stats::add_bytes(written);
+        }
+        if(sum){
+            // written at once, so that the lines of concurrent transfers don't mix.
+            std::ostringstream line;
+            line << progname << ": " << sum->name() << " " << std::hex << std::setfill('0')
+                << std::setw(sum->algorithm() == checksum_algorithm::CRC32C ? 8 : 16)
+                << sum->value() << std::endl;
+            std::cerr << line.str() << std::flush;
+        }
+
+        // only the pages written are synchronized. windows of a streamed destination
+        // are synchronized as they are unmapped. device memory has nothing to synchronize.
+        if(sync != sync_mode::NONE && dest.mmapped_data_ && 0 < written){
+            stats::timer t(phase::MSYNC);
+            stats::add_syscall();
+            if(msync(dest.mmapped_data_.get(), dest.page_offset_ + written, MS_SYNC) == -1){
+                ERROR("msync");
+            }
         }
+        if(sync == sync_mode::FULL){
+            stats::timer t(phase::FSYNC);
+            stats::add_syscall();
+            if(fsync(*dest.ptr_to_fd_) == -1){
+                ERROR("fsync");
+            }
+        }else if(sync == sync_mode::DATA){
+            stats::timer t(phase::FSYNC);
+            stats::add_syscall();
+            if(fdatasync(*dest.ptr_to_fd_) == -1){
+                ERROR("fdatasync");
+            }
+        }
+        return 0;
+    };
+}
+
+std::function<int()> target::compile_compare(const target& other, const param& prm, int out)const
+{
+    if(!is_mapped() || !other.is_mapped()){
+        errno = EINVAL;
+        ERROR_THROW("only regions and files can be compared");
     }
 
-    return 0;
+    set_scheduling_policy(prm.scheduling_policy);
+    set_signal_handler();
+
+    const compare_function compare = select_compare_kernel(prm.kernel);
+
+    return [this, &other, &prm, out, compare]{
+        const cpu_affinity_scope pinned(prm.cpus);
+        std::optional<stopwatch> sw;
+        if(prm.verbose){
+            sw.emplace("compare: ");
+        }
+
+        // a word is aligned to its address in this region, and is cut at the ends of it.
+        struct mismatch{
+            std::uint64_t src;
+            std::uint64_t dst;
+        };
+        const std::size_t width = static_cast<std::size_t>(prm.width) / 8;
+        const std::size_t length = std::min(length_, other.length_);
+        std::atomic<std::size_t> differing(0);
+        std::mutex mutex;
+        // the first ones, keyed by the address of the word.
+        std::map<std::size_t, mismatch> mismatches;
+
+        const int ret = [&]{
+            stats::timer t(phase::COPY);
+            return stream(this, &other, length, [&](std::size_t pos, std::size_t n, const char* s, char* d){
+                const copy_split split = split_copy(n, copy_destination::MEMORY, prm);
+                worker_pool::instance(prm.scheduling_policy, split.jobs, prm.cpus).run_chunked(
+                        offset_ + pos, n, split.chunk_size, split.jobs, [&](std::size_t first, std::size_t last){
+                    std::size_t count = 0;
+                    std::map<std::size_t, mismatch> found;
+                    for(std::size_t i = first + compare(s + first, d + first, last - first); i < last;){
+                        const std::size_t address = offset_ + pos + i;
+                        const std::size_t word = address - address % width;
+                        const std::size_t lo = std::max(word, offset_ + pos + first) - (offset_ + pos);
+                        const std::size_t hi = std::min(word + width, offset_ + pos + last) - (offset_ + pos);
+
+                        ++count;
+                        if(found.size() < prm.max_mismatches){
+                            alignas(std::uint64_t) char src_word[sizeof(std::uint64_t)] = {};
+                            alignas(std::uint64_t) char dst_word[sizeof(std::uint64_t)] = {};
+                            std::memcpy(src_word + (offset_ + pos + lo - word), s + lo, hi - lo);
+                            std::memcpy(dst_word + (offset_ + pos + lo - word), d + lo, hi - lo);
+                            found[word] = mismatch{fetch(src_word, prm.width, prm.endianness),
+                                fetch(dst_word, prm.width, prm.endianness)};
+                        }
+                        i = hi < last ? hi + compare(s + hi, d + hi, last - hi) : last;
+                    }
+
+                    differing += count;
+                    if(!found.empty()){
+                        std::lock_guard<std::mutex> lock(mutex);
+                        mismatches.insert(found.begin(), found.end());
+                        while(prm.max_mismatches < mismatches.size()){
+                            mismatches.erase(std::prev(mismatches.end()));
+                        }
+                    }
+                });
+                return 0;
+            });
+        }();
+        if(ret != 0){
+            return ret;
+        }
+        stats::add_bytes(length);
+
+        if(out != -1 && !mismatches.empty()){
+            const int digits = prm.width / 4;
+            std::string report = std::string("Offset           ")
+                + "SRC" + std::string(static_cast<std::size_t>(std::max(digits - 2, 1)), ' ') + "DST\n";
+            for(const auto& [word, m]: mismatches){
+                char line[64];
+                const int len = std::snprintf(line, sizeof(line), "%016zx %0*" PRIx64 " %0*" PRIx64 "\n",
+                        word, digits, m.src, digits, m.dst);
+                report.append(line, static_cast<std::size_t>(len));
+            }
+            if(iohelper::write(out, report.data(), report.size()) == -1){
+                ERROR("write");
+            }
+        }
+        if(0 < differing){
+            std::cerr << progname << ": " << differing << " words differ" << std::endl;
+        }
+        if(length_ != other.length_){
+            std::cerr << progname << ": lengths differ: " << length_ << ", " << other.length_ << std::endl;
+        }
+        return 0 < differing || length_ != other.length_ ? differ : 0;
+    };
 }
 
-int target::write_to(const target& dest, const param& prm)const
+std::function<int()> target::compile_search(const param& prm, int out)const
 {
-    const std::size_t jobs = static_cast<std::size_t>(prm.jobs);
+    if(!is_mapped()){
+        errno = EINVAL;
+        ERROR_THROW("only regions and files can be searched");
+    }
+
+    set_scheduling_policy(prm.scheduling_policy);
+    set_signal_handler();
+
+    const needle wanted(prm.search, prm.width, prm.endianness, prm.kernel);
+
+    return [this, &prm, out, wanted]{
+        const cpu_affinity_scope pinned(prm.cpus);
+        std::optional<stopwatch> sw;
+        if(prm.verbose){
+            sw.emplace("search: ");
+        }
+
+        const std::size_t size = wanted.size();
+        std::size_t found = 0;
+        // the tail of the previous window, which a match may start in, and where it is.
+        std::string carry;
+        std::size_t carry_pos = 0;
+
+        const int ret = [&]{
+            stats::timer t(phase::COPY);
+            return stream(this, nullptr, length_, [&](std::size_t pos, std::size_t n, const char* s, char*){
+                std::mutex mutex;
+                // the addresses found in each chunk, keyed by its first byte.
+                std::map<std::size_t, std::vector<std::size_t>> matches;
+
+                // a match across the windows is looked for in a copy of both ends of them,
+                // at the same alignment, for the words to be aligned to their addresses.
+                if(!carry.empty()){
+                    const std::size_t head = std::min(n, size - 1);
+                    std::vector<char> joined(carry.size() + head + 64);
+                    const std::size_t address = offset_ + carry_pos;
+                    char* const j = joined.data()
+                        + ((address - reinterpret_cast<std::uintptr_t>(joined.data())) & 63);
+                    std::memcpy(j, carry.data(), carry.size());
+                    std::memcpy(j + carry.size(), s, head);
+                    const std::size_t len = carry.size() + head;
+                    for(std::size_t i = wanted.find(j, len); i < carry.size(); i += 1 + wanted.find(j + i + 1, len - i - 1)){
+                        matches[0].push_back(address + i);
+                    }
+                }
 
+                const copy_split split = split_copy(n, copy_destination::MEMORY, prm);
+                worker_pool::instance(prm.scheduling_policy, split.jobs, prm.cpus).run_chunked(
+                        offset_ + pos, n, split.chunk_size, split.jobs, [&](std::size_t first, std::size_t last){
+                    // a match starting in the chunk may end in the next one.
+                    const std::size_t end = std::min(n, last + size - 1);
+                    std::vector<std::size_t> addresses;
+                    for(std::size_t i = first + wanted.find(s + first, end - first); i < last;
+                            i += 1 + wanted.find(s + i + 1, end - i - 1)){
+                        addresses.push_back(offset_ + pos + i);
+                    }
+                    if(!addresses.empty()){
+                        std::lock_guard<std::mutex> lock(mutex);
+                        // after the ones across the windows, which are keyed by 0.
+                        matches[first + 1] = std::move(addresses);
+                    }
+                });
+
+                std::string lines;
+                for(const auto& chunk: matches){
+                    for(const std::size_t address: chunk.second){
+                        char line[32];
+                        const int len = std::snprintf(line, sizeof(line), "%016zx\n", address);
+                        lines.append(line, static_cast<std::size_t>(len));
+                        ++found;
+                    }
+                }
+                if(!lines.empty() && iohelper::write(out, lines.data(), lines.size()) == -1){
+                    ERROR("write");
+                }
+
+                const std::size_t tail = std::min(n, size - 1);
+                carry.assign(s + n - tail, tail);
+                carry_pos = pos + n - tail;
+                return 0;
+            });
+        }();
+        if(ret != 0){
+            return ret;
+        }
+        stats::add_bytes(length_);
+        return 0 < found ? 0 : not_found;
+    };
+}
+
+int target::write_to(const target& dest, const param& prm, checksum* sum, bool lend)const
+{
     bool use_pwrite;
 
     switch(dest.stat_.st_mode & S_IFMT){
@@ -142,33 +605,183 @@ int target::write_to(const target& dest, const param& prm)const
         break;
     }
 
+    const int fd = *dest.ptr_to_fd_;
+    const off_t origin = static_cast<off_t>(dest.length_);
+    const bool to_pipe = lend && (dest.stat_.st_mode & S_IFMT) == S_IFIFO;
+
+    const int ret = stream(this, nullptr, length_,
+            [&](std::size_t pos, std::size_t n, const char* s, char*){
+                if(use_pwrite){
+                    if(iohelper::pwrite(fd, s, n, origin + static_cast<off_t>(pos), prm, sum) == -1){
+                        ERROR("pwrite");
+                    }
+                    return 0;
+                }
+                if(sum){
+                    if(iohelper::write(fd, s, n, *sum) == -1){
+                        ERROR("write");
+                    }
+                    return 0;
+                }
+
+                // a pipe can take the mapped pages by reference instead of a copy of them.
+                ssize_t spliced = to_pipe ? iohelper::vmsplice(fd, s, n) : 0;
+                if(spliced == -1){
+                    switch(errno){
+                    case EINVAL: case ENOSYS: case EFAULT: case EBADF:
+                        // e.g. device memory, which has no struct page to hand over.
+                        spliced = 0;
+                        break;
+                    default:
+                        ERROR("vmsplice");
+                    }
+                }
+
+                const std::size_t done = static_cast<std::size_t>(spliced);
+                if(done < n && iohelper::write(fd, s + done, n - done) == -1){
+                    ERROR("write");
+                }
+                return 0;
+            });
+    if(ret != 0){
+        return ret;
+    }
+
     if(use_pwrite){
-        if(iohelper::pwrite(*dest.ptr_to_fd_, offset(), length_,
-                    static_cast<off_t>(dest.length_), prm.scheduling_policy, jobs) == -1){
-            ERROR("pwrite");
-        }
         dest.length_ += length_;
-    }else{
-        if(iohelper::write(*dest.ptr_to_fd_, offset(), length_) == -1){
-            ERROR("write");
-        }
     }
-
     return 0;
 }
 
 void target::mmap(int prot)
 {
-    void* m = ::mmap(nullptr, page_offset_ + length_, prot, MAP_SHARED | MAP_POPULATE, *ptr_to_fd_,
+    void* m = map_pages(*ptr_to_fd_, page_offset_ + length_, prot,
             static_cast<off_t>(offset_ & ~(
-                    static_cast<std::size_t>(page_size_) - 1)));
+                    static_cast<std::size_t>(page_size_) - 1)),
+            is_regular_file(), policy_);
 
     if(m == MAP_FAILED){
         ERROR_THROW("mmap");
     }
 
+    const std::size_t size = page_offset_ + length_;
     mmapped_data_.reset(reinterpret_cast<char*>(m),
-            [&](char* p){::munmap(p, page_offset_ + length_);});
+            [size](char* p){stats::add_syscall(); ::munmap(p, size);});
+    prot_ = prot;
+}
+
+bool target::is_stable(const param& prm)const
+{
+    return prot_ == PROT_READ && prm.repeat == 1
+        && std::none_of(prm.transfers.begin(), prm.transfers.end(), [this](const transfer& t){
+            return t.dst && !t.compare && t.dst->overlaps(*this);
+        });
+}
+
+bool target::overlaps(const target& other)const
+{
+    if(this == &other){
+        return true;
+    }
+    if(pattern_ || other.pattern_){
+        return false;
+    }
+    if(stat_.st_dev != other.stat_.st_dev || stat_.st_ino != other.stat_.st_ino){
+        return false;
+    }
+    if(!is_mapped() || !other.is_mapped()){
+        return true;
+    }
+    return offset_ < other.offset_ + other.length_ && other.offset_ < offset_ + length_;
+}
+
+std::shared_ptr<char> target::view(std::size_t pos, std::size_t n, bool sync)const
+{
+    if(mmapped_data_){
+        return std::shared_ptr<char>(mmapped_data_, mmapped_data_.get() + page_offset_ + pos);
+    }
+
+    const std::size_t first = (offset_ + pos) & ~(static_cast<std::size_t>(page_size_) - 1);
+    const std::size_t size = offset_ + pos - first + n;
+    void* m = map_pages(*ptr_to_fd_, size, prot_, static_cast<off_t>(first),
+            is_regular_file(), policy_);
+
+    if(m == MAP_FAILED){
+        ERROR_THROW("mmap");
+    }
+
+    const bool synced = sync && (prot_ & PROT_WRITE);
+    const std::shared_ptr<char> window(reinterpret_cast<char*>(m), [size, synced](char* p){
+        if(synced){
+            stats::timer t(phase::MSYNC);
+            stats::add_syscall();
+            if(msync(p, size, MS_SYNC) == -1){
+                WARN(std::string("msync: ") + std::strerror(errno));
+            }
+        }
+        stats::add_syscall();
+        ::munmap(p, size);
+    });
+    return std::shared_ptr<char>(window, window.get() + (offset_ + pos - first));
+}
+
+int target::stream(const target* src, const target* dst, std::size_t length,
+        const window_function& f, bool sync)
+{
+    // windows are aligned to multiples of the window size in the source,
+    // so that each of them is mapped with no more pages than necessary.
+    std::size_t window = 0;
+    for(const target* t: {src, dst}){
+        if(t && t->is_streamed()){
+            window = window == 0 ? t->window_ : std::min(window, t->window_);
+        }
+    }
+    const std::size_t origin = (src ? src : dst)->page_offset_;
+    const auto window_end = [=](std::size_t pos){
+        return window == 0 ? length : std::min(length, (origin + pos) / window * window + window - origin);
+    };
+
+    using views = std::pair<std::shared_ptr<char>, std::shared_ptr<char>>;
+    const auto map = [src, dst, sync](std::size_t pos, std::size_t n){
+        return views(src ? src->view(pos, n, sync) : nullptr, dst ? dst->view(pos, n, sync) : nullptr);
+    };
+
+    if(length == 0){
+        return 0;
+    }
+
+    // the next window gets mapped and populated in the background while the current
+    // one is processed. it refers to the targets, so it is waited for on any way out.
+    std::future<views> next;
+    struct waiter{
+        std::future<views>& f;
+        ~waiter(){ if(f.valid()){ f.wait(); } }
+    }const wait_next{next};
+
+    std::size_t pos = 0;
+    std::size_t end = window_end(pos);
+    views current = map(pos, end - pos);
+    while(true){
+        const std::size_t next_end = window_end(end);
+        if(end < length){
+            next = background_thread::instance().submit([&map, end, next_end]{
+                return map(end, next_end - end);
+            });
+        }
+
+        const int ret = f(pos, end - pos, current.first.get(), current.second.get());
+        if(ret != 0){
+            return ret;
+        }
+        if(!next.valid()){
+            return 0;
+        }
+
+        current = views();
+        current = next.get();
+        pos = end;
+        end = next_end;
+    }
 }
 
 std::size_t target::init_length(std::size_t length, target_role role)
@@ -180,7 +793,8 @@ std::size_t target::init_length(std::size_t length, target_role role)
     switch(stat_.st_mode & S_IFMT){
     case S_IFREG:
     case S_IFLNK:
-        if(role == target_role::SRC){
+        // a file given with its length is a region of it, in the same way as /dev/mem.
+        if(role == target_role::SRC && length == 0){
             return static_cast<std::size_t>(stat_.st_size);
         }
         return length;
@@ -201,7 +815,7 @@ void target::preprocess(target_role role)
     switch(stat_.st_mode & S_IFMT){
     case S_IFREG:
     case S_IFLNK:
-        if(role == target_role::DST && iohelper::ftruncate(*ptr_to_fd_, 0) == -1){
+        if(role == target_role::DST && length_ == 0 && iohelper::ftruncate(*ptr_to_fd_, 0) == -1){
             ERROR_THROW("ftruncate");
         }
         break;
@@ -217,9 +831,55 @@ void target::preprocess(target_role role)
     }
 }
 
-int target::passthrough(const target& dest)const
+int target::passthrough(const target& dest, const param& prm, checksum* sum)const
 {
-    const std::size_t buff_size = static_cast<std::size_t>(page_size_) * 16ul;
+    const mode_t src_type = stat_.st_mode & S_IFMT;
+    const mode_t dst_type = dest.stat_.st_mode & S_IFMT;
+    const bool src_is_file = src_type == S_IFREG || src_type == S_IFLNK;
+    const bool dst_is_file = dst_type == S_IFREG || dst_type == S_IFLNK;
+
+    // let the kernel move the data if it can, without copying it through user space.
+    // a checksum needs to see the data, which has to go through the buffer instead.
+    ssize_t (*zero_copy)(int, int, std::size_t) = nullptr;
+    if(sum){
+        zero_copy = nullptr;
+    }else if(src_is_file && dst_is_file){
+        zero_copy = iohelper::copy_file_range;
+    }else if(src_is_file && (dst_type == S_IFSOCK || dst_type == S_IFIFO)){
+        zero_copy = iohelper::sendfile;
+    }else if(src_type == S_IFIFO || dst_type == S_IFIFO){
+        zero_copy = iohelper::splice;
+    }
+
+    if(zero_copy){
+        const std::size_t chunk = 1ul << 30;
+        std::size_t moved = 0;
+        ssize_t ret;
+        while((ret = zero_copy(*ptr_to_fd_, *dest.ptr_to_fd_, chunk)) > 0){
+            moved += static_cast<std::size_t>(ret);
+            stats::add_bytes(static_cast<std::size_t>(ret));
+            if(dst_is_file){
+                dest.length_ += static_cast<std::size_t>(ret);
+            }
+        }
+        // files of procfs or sysfs, e.g., claim to be empty to the kernel, but not to read().
+        // so nothing moved at all is told by the buffer, as cp does.
+        if(ret == 0 && 0 < moved){
+            return 0;
+        }
+        if(ret == -1){
+            switch(errno){
+            case EINVAL: case ENOSYS: case EXDEV: case EOPNOTSUPP: case EBADF:
+                // not supported for this pair of files. the rest goes through the buffer.
+                break;
+            default:
+                ERROR("zero-copy transfer");
+            }
+        }
+    }
+
+    const std::size_t buff_size = 0 < prm.buffer_size ? prm.buffer_size
+        : static_cast<std::size_t>(page_size_) * 16ul;
     std::shared_ptr<char[]> buff(new char[buff_size]);
 
     ssize_t r_ret;
@@ -228,82 +888,90 @@ int target::passthrough(const target& dest)const
             ERROR("read");
         }
         const std::size_t r = static_cast<std::size_t>(r_ret);
+        if(sum){
+            sum->update(buff.get(), r);
+        }
         ssize_t w_ret = iohelper::write(*dest.ptr_to_fd_, buff.get(), r);
         if(w_ret == -1){
             ERROR("write");
         }
-        switch(dest.stat_.st_mode & S_IFMT){
-        case S_IFREG: case S_IFLNK: dest.length_ += r; break;
-        default: break;
+        stats::add_bytes(r);
+        if(dst_is_file){
+            dest.length_ += r;
         }
     }
 
     return 0;
 }
 
-int target::hexdump(int fd, const char* data, std::size_t offset,
-        std::size_t length, std::size_t page_offset, const param& prm)
+int target::hexdump(const target& dest, const param& prm, checksum* sum)const
 {
-    const std::size_t bufsize = static_cast<std::size_t>(page_size_) * 20ul;
-
-    iohelper ioh(fd, bufsize);
-    ioh.snprintf(
-    "Offset%*s ""0       %s4        8       %sc         ASCII\n"
-    "%.*s "     "--------%s-----------------%s--------  ----------------\n",
-    2 * sizeof(std::size_t) - 6, "",             prm.width < 64 ? " ": "", prm.width < 64 ? " ": "",
-    2 * sizeof(std::size_t), "----------------", prm.width < 64 ? "-": "", prm.width < 64 ? "-": "");
-
-    std::size_t column_heading = offset & ~0xful;
-    bool needs_column_heading_print = true;
-
-    // this contains space not only for termination character '\0',
-    // but also for preceeding character '>'.
-    char ascii[0x10 + 2] = {'>'};
-
-    const std::size_t bytewise_width = static_cast<std::size_t>(prm.width) / 8;
-    for(std::size_t i = page_offset & ~0xful; i < page_offset + length; i += bytewise_width){
+    const int fd = *dest.ptr_to_fd_;
+    hexdump_formatter formatter(nullptr, offset_, length_, page_offset_,
+            prm.width, prm.endianness);
 
-        if(needs_column_heading_print){
-            ioh.snprintf("%0*zx", 2 * sizeof(std::size_t), column_heading);
-            column_heading += 0x10;
-            needs_column_heading_print = false;
-        }
-
-        if((i & 0x3) == 0x0){
-            ioh.snprintf(" ");
-        }
-
-        if(i < page_offset){
-            ioh.snprintf("%*s", 2 * static_cast<int>(bytewise_width), "");
-            std::snprintf(ascii, sizeof(ascii), "%*s>",
-                    static_cast<int>((i + bytewise_width) & ~(bytewise_width - 1)), "");
-        }else{
-            ioh.snprintf("%0*lx", prm.width / 4, fetch(data + i, prm.width, prm.endianness));
-            const std::uint64_t value_in_stack = fetch(data + i, prm.width);
-            const char* p = reinterpret_cast<const char*>(&value_in_stack);
-            for(std::size_t j = 0; j < bytewise_width; ++j){
-                ascii[((i + j) & 0xful) + 1] = std::isprint(p[j]) ? p[j] : '.';
-            }
-        }
-
-        if(((i + bytewise_width) & 0xful) == 0x0){
-            ioh.snprintf(" %s<\n", ascii);
-            std::memset(ascii, '\0', sizeof(ascii));
-            ascii[0] = '>';
-            needs_column_heading_print = true;
-        }
+    char header[hexdump_formatter::max_header_size];
+    if(iohelper::write(fd, header, formatter.header(header)) == -1){
+        ERROR("write");
     }
 
-    const std::size_t padding_for_hex = (0xful
-            - (((page_offset + length - 1 + bytewise_width) & ~(bytewise_width - 1)) & 0xful)
-            + 1) & 0xful;
-    const std::size_t padding_for_sep = ((~(page_offset + length -1)) >> 2 & 0x3);
-    ioh.snprintf("%*s", static_cast<int>(2 * padding_for_hex + padding_for_sep), "");
+    // the lines in a window are split into chunks, which are formatted in parallel
+    // and written out in order. a chunk is claimed only after all the preceding
+    // ones, so that no more than 'jobs' chunks are in flight at once, and
+    // each of them can use its own buffer.
+    const std::size_t jobs = static_cast<std::size_t>(prm.jobs);
+    const std::size_t lines_per_chunk = static_cast<std::size_t>(page_size_);
+    const std::size_t bufsize = lines_per_chunk * hexdump_formatter::max_line_size;
+
+    std::vector<std::unique_ptr<char[]>> buffers(jobs);
+    std::mutex mutex;
+    std::condition_variable turn_changed;
+
+    return stream(this, nullptr, length_, [&](std::size_t pos, std::size_t n, const char* s, char*){
+        // a line belongs to the window its first byte lies in,
+        // and the one before the region to the first window.
+        const std::size_t first_line = formatter.line_at(pos == 0 ? 0 : page_offset_ + pos);
+        const std::size_t last_line = formatter.line_at(page_offset_ + pos + n);
+        const std::size_t chunks = (last_line - first_line + lines_per_chunk - 1) / lines_per_chunk;
+        const std::size_t slots = std::min(jobs, chunks);
+        formatter.rebase(s, page_offset_ + pos);
+
+        std::size_t turn = 0;
+        bool failed = false;
+
+        worker_pool::instance(prm.scheduling_policy, jobs, prm.cpus).run(chunks, jobs, [&](std::size_t i){
+            std::unique_ptr<char[]>& buf = buffers.at(i % slots);
+            if(!buf){
+                buf.reset(new char[bufsize]);
+            }
 
-    if(ascii[1]){
-        ioh.snprintf(" %s<\n", ascii);
-    }
-    return 0;
+            const std::size_t first = first_line + i * lines_per_chunk;
+            const std::size_t last = std::min(first + lines_per_chunk, last_line);
+            const std::size_t len = formatter.format(buf.get(), first, last);
+            // the bytes of the lines are summed while they're still in the cache.
+            const std::size_t begin = formatter.region_at(first);
+            const std::size_t end = formatter.region_at(last);
+            const std::uint64_t digest = sum ?
+                sum->compute(s + (begin - page_offset_ - pos), end - begin) : 0;
+
+            std::unique_lock<std::mutex> lock(mutex);
+            turn_changed.wait(lock, [&]{return turn == i;});
+            if(sum){
+                sum->append(digest, end - begin);
+            }
+            const bool skipped = failed;
+            failed = skipped || iohelper::write(fd, buf.get(), len) == -1;
+            const bool error = failed && !skipped;
+            ++turn;
+            lock.unlock();
+            turn_changed.notify_all();
+
+            if(error){
+                ERROR_THROW("write");
+            }
+        });
+        return 0;
+    });
 }
 
 std::uint64_t target::fetch(const void* p, int width, endian e)
@@ -360,59 +1028,12 @@ int target::select_file_flags(target_role r)
     return ret;
 }
 
-target::iohelper::iohelper(int fd, std::size_t size)
-:fd_(fd),
-size_(size),
-buf_(new char[size_]),
-count_(){}
-
-target::iohelper::~iohelper()
-{
-    if(count_ <= 0){
-        return;
-    }
-    ssize_t ret = iohelper::write(fd_, buf_.get(), count_);
-    if(ret == -1){
-        ERROR_BASE("write", /* do nothing */);
-    }
-}
-
-template <typename... Args>
-__attribute__((format(printf, 2, 3)))
-int target::iohelper::snprintf(const char* format, Args... args)
-{
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wformat-nonliteral"
-#pragma GCC diagnostic ignored "-Wformat-security"
-    const int printf_ret = std::snprintf(
-            buf_.get() + count_,
-            size_ - count_, format, args...);
-#pragma GCC diagnostic pop
-
-    if(printf_ret < 0){
-        ERROR("std::snprintf");
-    }
-    if(static_cast<std::size_t>(size_ - count_) <= static_cast<std::size_t>(printf_ret)){
-        ERROR("truncating occurred in std::snprintf");
-    }
-
-    count_ += static_cast<decltype(count_)>(printf_ret);
-
-    if(size_ * 8 / 10 < count_){
-        /* if buf_ is filled 80% or more, flush it. */
-        ssize_t ret = iohelper::write(fd_, buf_.get(), count_);
-        if(ret == -1){
-            ERROR("write");
-        }
-        count_ = 0;
-    }
-    return 0;
-}
-
 int target::iohelper::open(const char* pathname, int flags, mode_t mode)
 {
+    stats::timer t(phase::OPEN);
     int ret;
     do{
+        stats::add_syscall();
         ret = ::open(pathname, flags, mode);
     }while(ret == -1 && errno == EINTR);
     return ret;
@@ -422,6 +1043,7 @@ ssize_t target::iohelper::read(int fd, void* buf, size_t count)
 {
     ssize_t ret;
     do{
+        stats::add_syscall();
         ret = ::read(fd, buf, count);
     }while(ret == -1 && errno == EINTR);
     return ret;
@@ -433,6 +1055,7 @@ ssize_t target::iohelper::write(int fd, const void* buf, size_t count)
     ssize_t ret;
     do{
         do{
+            stats::add_syscall();
             ret = ::write(fd, reinterpret_cast<const char*>(buf) + done, count - done);
         }while(ret == -1 && errno == EINTR);
         if(ret == -1){
@@ -449,6 +1072,7 @@ ssize_t target::iohelper::pwrite(int fd, const void* buf, size_t count, off_t of
     ssize_t ret;
     do{
         do{
+            stats::add_syscall();
             ret = ::pwrite(fd, reinterpret_cast<const char*>(buf) + done,
                     count - done, offset + static_cast<off_t>(done));
         }while(ret == -1 && errno == EINTR);
@@ -460,8 +1084,75 @@ ssize_t target::iohelper::pwrite(int fd, const void* buf, size_t count, off_t of
     return ret;
 }
 
+ssize_t target::iohelper::copy_file_range(int fd_in, int fd_out, size_t count)
+{
+    ssize_t ret;
+    do{
+        stats::add_syscall();
+        ret = ::copy_file_range(fd_in, nullptr, fd_out, nullptr, count, 0);
+    }while(ret == -1 && errno == EINTR);
+    return ret;
+}
+
+ssize_t target::iohelper::sendfile(int fd_in, int fd_out, size_t count)
+{
+    ssize_t ret;
+    do{
+        stats::add_syscall();
+        ret = ::sendfile(fd_out, fd_in, nullptr, count);
+    }while(ret == -1 && errno == EINTR);
+    return ret;
+}
+
+ssize_t target::iohelper::splice(int fd_in, int fd_out, size_t count)
+{
+    ssize_t ret;
+    do{
+        stats::add_syscall();
+        ret = ::splice(fd_in, nullptr, fd_out, nullptr, count, SPLICE_F_MOVE | SPLICE_F_MORE);
+    }while(ret == -1 && errno == EINTR);
+    return ret;
+}
+
+ssize_t target::iohelper::vmsplice(int fd, const void* buf, size_t count)
+{
+    const std::size_t page_size = static_cast<std::size_t>(page_size_);
+    const int pipe_size = ::fcntl(fd, F_GETPIPE_SZ);
+    const std::size_t pipe_pages = 0 < pipe_size ? static_cast<std::size_t>(pipe_size) / page_size : 1ul;
+    const std::size_t max_segs = std::min(static_cast<std::size_t>(IOV_MAX), std::max(pipe_pages, 1ul));
+
+    // the region is handed over in page sized segments, no more than the pipe can hold at once.
+    std::vector<struct iovec> iov;
+    iov.reserve(max_segs);
+
+    const char* p = reinterpret_cast<const char*>(buf);
+    std::size_t done = 0;
+    while(done < count){
+        iov.clear();
+        std::size_t pos = done;
+        while(pos < count && iov.size() < max_segs){
+            const std::size_t boundary = (reinterpret_cast<std::uintptr_t>(p + pos) | (page_size - 1)) + 1;
+            const std::size_t len = std::min(count - pos, boundary - reinterpret_cast<std::uintptr_t>(p + pos));
+            iov.push_back({const_cast<char*>(p + pos), len});
+            pos += len;
+        }
+
+        ssize_t ret;
+        do{
+            stats::add_syscall();
+            ret = ::vmsplice(fd, iov.data(), iov.size(), 0);
+        }while(ret == -1 && errno == EINTR);
+        if(ret == -1){
+            return done == 0 ? -1 : static_cast<ssize_t>(done);
+        }
+        done += static_cast<std::size_t>(ret);
+    }
+    return static_cast<ssize_t>(done);
+}
+
 off_t target::iohelper::lseek(int fd, off_t offset, int whence)
 {
+    stats::add_syscall();
     off_t ret = ::lseek(fd, offset, whence);
     if(ret == -1){
         if(errno != ESPIPE){
@@ -476,6 +1167,7 @@ int target::iohelper::ftruncate(int fd, off_t length)
 {
     int ret;
     do{
+        stats::add_syscall();
         ret = ::ftruncate(fd, length);
     }while(ret == -1 && errno == EINTR);
     return ret;
@@ -486,6 +1178,7 @@ void target::iohelper::close(int* fd_ptr)
     if(0 <= *fd_ptr){
         int ret;
         do{
+            stats::add_syscall();
             ret = ::close(*fd_ptr);
         }while(ret == -1 && errno == EINTR);
     }
@@ -494,6 +1187,8 @@ void target::iohelper::close(int* fd_ptr)
 
 struct stat target::iohelper::fstat(int fd)
 {
+    stats::timer t(phase::FSTAT);
+    stats::add_syscall();
     struct stat buf;
     if(0 <= fd && ::fstat(fd, &buf) == -1){
         ERROR_THROW("fstat");
@@ -501,57 +1196,268 @@ struct stat target::iohelper::fstat(int fd)
     return buf;
 }
 
-void *target::iohelper::memcpy(void *dest, const void *src, size_t n, int sched_policy, size_t jobs)
+// the bytes summed at once, which are few enough to stay in the cache in between.
+constexpr std::size_t summed_block = 1 << 18;
+
+// calls task(first, last, part) for the chunks of [0, n) in the same way as run_chunked(),
+// and appends the parts to 'sum', if any, in order. the task appends the bytes it has moved
+// to 'part', which is null unless there is 'sum'.
+static void run_chunked_summed(const param& prm, const copy_split& split, std::size_t origin,
+        std::size_t n, checksum* sum,
+        const std::function<void(std::size_t first, std::size_t last, checksum* part)>& task)
+{
+    std::mutex mutex;
+    // the digests and the lengths of the chunks, keyed by their first bytes.
+    std::map<std::size_t, std::pair<std::uint64_t, std::size_t>> digests;
+
+    worker_pool::instance(prm.scheduling_policy, split.jobs, prm.cpus).run_chunked(
+            origin, n, split.chunk_size, split.jobs, [&](std::size_t first, std::size_t last){
+        if(!sum){
+            task(first, last, nullptr);
+            return;
+        }
+        checksum part(sum->algorithm());
+        task(first, last, &part);
+        std::lock_guard<std::mutex> lock(mutex);
+        digests.emplace(first, std::make_pair(part.value(), last - first));
+    });
+
+    for(const auto& d : digests){
+        sum->append(d.second.first, d.second.second);
+    }
+}
+
+// calls f(p, len) for the blocks of n bytes from 's', each of which is copied to 'p',
+// a buffer of this thread, and appended to 'part' beforehand. thus 's' is read only once.
+static void bounce(const char* s, std::size_t n, checksum& part,
+        const std::function<void(const char* p, std::size_t len)>& f)
+{
+    thread_local std::unique_ptr<char[]> buf(new char[summed_block]);
+    for(std::size_t i = 0; i < n; i += summed_block){
+        const std::size_t len = std::min(summed_block, n - i);
+        std::memcpy(buf.get(), s + i, len);
+        part.update(buf.get(), len);
+        f(buf.get(), len);
+    }
+}
+
+void *target::iohelper::memcpy(void *dest, const void *src, size_t n, const param& prm,
+        checksum* sum)
 {
-    std::vector<std::thread> threads;
-    const std::size_t len = n / jobs;
+    const copy_split split = split_copy(n, copy_destination::MEMORY, prm);
 
     char* d = reinterpret_cast<char*>(dest);
     const char* s = reinterpret_cast<const char*>(src);
-
-    for(unsigned int i = 0; i < jobs; ++i){
-        threads.emplace_back(std::thread([sched_policy](void* dp, const void* sp, std::size_t l){
-            set_scheduling_policy(sched_policy);
-            set_signal_handler();
-            std::memcpy(dp, sp, l);
-        }, d + i * len, s + i * len, len));
-    }
-    for(unsigned int i = 0; i < jobs; ++i){
-        threads.at(i).join();
-    }
-    const std::size_t round = len * jobs;
-    const std::size_t residue = n % jobs;
-    std::memcpy(d + round, s + round, residue);
+    const std::size_t origin = reinterpret_cast<std::uintptr_t>(dest);
+
+    const copy_function copy = select_copy_kernel(prm.kernel);
+    const bool nontemporal = effective_nontemporal_threshold(prm.nontemporal_threshold) <= n;
+
+    // with a checksum, the data goes through a buffer in the cache, which is summed,
+    // so that neither the source nor the destination, e.g. registers, is read twice.
+    run_chunked_summed(prm, split, origin, n, sum,
+            [=](std::size_t first, std::size_t last, checksum* part){
+        if(!part){
+            copy(d + first, s + first, last - first, nontemporal);
+            return;
+        }
+        char* to = d + first;
+        bounce(s + first, last - first, *part, [copy, nontemporal, &to](const char* p, std::size_t len){
+            copy(to, p, len, nontemporal);
+            to += len;
+        });
+    });
 
     return dest;
 }
 
-ssize_t target::iohelper::pwrite(int fd, const void* buf, size_t count, off_t offset, int sched_policy, size_t jobs)
+ssize_t target::iohelper::pwrite(int fd, const void* buf, size_t count, off_t offset,
+        const param& prm, checksum* sum)
 {
-    std::vector<std::thread> threads;
-    const std::size_t len = count / jobs;
+    // the kernel reads the buffer on its own with io_uring, thus a checksum
+    // of what is written needs the threads, which copy it through their buffers.
+    if(prm.engine == io_engine::URING && !sum){
+        // the ring is set up once per thread, and kept for the following transfers.
+        thread_local std::unique_ptr<uring> ring;
+        thread_local bool unavailable = false;
+        if(!unavailable && (!ring || ring->depth() != prm.queue_depth)){
+            try{
+                ring.reset();
+                ring.reset(new uring(prm.queue_depth));
+            }catch(const std::runtime_error&){
+                // e.g. disabled by seccomp in containers.
+                WARN("io_uring is not available. falling back to threads.");
+                unavailable = true;
+            }
+        }
+        if(ring){
+            const ssize_t ret = ring->pwrite(fd, buf, count, offset, prm.block_size);
+            if(ret != -1 || (errno != EINVAL && errno != EOPNOTSUPP)){
+                return ret;
+            }
+            // the kernel may refuse the writes for some files, e.g. of older
+            // filesystems. they are done again by threads, from the start.
+            WARN("io_uring rejected the writes. falling back to threads.");
+            ring.reset();
+            unavailable = true;
+        }
+    }
+
+    const copy_split split = split_copy(count, copy_destination::DESCRIPTOR, prm);
 
     const char* b = reinterpret_cast<const char*>(buf);
+    const std::size_t origin = static_cast<std::size_t>(offset);
 
-    for(unsigned int i = 0; i < jobs; ++i){
-        threads.emplace_back(std::thread([fd, sched_policy](const void* bp, size_t cnt, off_t os){
-            set_scheduling_policy(sched_policy);
-            set_signal_handler();
-            if(iohelper::pwrite(fd, bp, cnt, os) == -1){
+    run_chunked_summed(prm, split, origin, count, sum,
+            [=](std::size_t first, std::size_t last, checksum* part){
+        if(!part){
+            if(iohelper::pwrite(fd, b + first, last - first,
+                        offset + static_cast<off_t>(first)) == -1){
+                ERROR_THROW("pwrite");
+            }
+            return;
+        }
+        off_t pos = offset + static_cast<off_t>(first);
+        bounce(b + first, last - first, *part, [fd, &pos](const char* p, std::size_t len){
+            if(iohelper::pwrite(fd, p, len, pos) == -1){
                 ERROR_THROW("pwrite");
             }
-        }, b + i * len, len, offset + static_cast<off_t>(i * len)));
+            pos += static_cast<off_t>(len);
+        });
+    });
+
+    return static_cast<ssize_t>(count);
+}
+
+void target::iohelper::fill(char* dest, const pattern& p, size_t pos, size_t n, const param& prm,
+        checksum* sum)
+{
+    const copy_split split = split_copy(n, copy_destination::MEMORY, prm);
+    const copy_function copy = select_copy_kernel(prm.kernel);
+    const bool nontemporal = effective_nontemporal_threshold(prm.nontemporal_threshold) <= n;
+
+    // the blocks are summed as generated, thus 'dest' is never read.
+    run_chunked_summed(prm, split, reinterpret_cast<std::uintptr_t>(dest), n, sum,
+            [&](std::size_t first, std::size_t last, checksum* part){
+        p.fill(dest + first, pos + first, last - first, copy, nontemporal, part);
+    });
+}
+
+ssize_t target::iohelper::write(int fd, const void* buf, size_t count, checksum& sum)
+{
+    bool failed = false;
+    bounce(static_cast<const char*>(buf), count, sum, [fd, &failed](const char* p, std::size_t len){
+        failed = failed || iohelper::write(fd, p, len) == -1;
+    });
+    return failed ? -1 : static_cast<ssize_t>(count);
+}
+
+template<typename T>
+static void copy_register(char* dest, const char* src)
+{
+    *static_cast<volatile T*>(static_cast<volatile void*>(dest))
+        = *static_cast<const volatile T*>(static_cast<const volatile void*>(src));
+}
+
+void target::iohelper::copy_registers(char* dest, const char* src, std::size_t n, int width)
+{
+    for(std::size_t i = 0; i < n;){
+        const std::uintptr_t addresses = reinterpret_cast<std::uintptr_t>(dest + i)
+            | reinterpret_cast<std::uintptr_t>(src + i);
+        std::size_t w = static_cast<std::size_t>(width) / 8;
+        while(1 < w && ((addresses & (w - 1)) != 0 || n - i < w)){
+            w /= 2;
+        }
+        switch(w){
+        case 8:  copy_register<std::uint64_t>(dest + i, src + i); break;
+        case 4:  copy_register<std::uint32_t>(dest + i, src + i); break;
+        case 2:  copy_register<std::uint16_t>(dest + i, src + i); break;
+        default: copy_register<std::uint8_t>(dest + i, src + i); w = 1; break;
+        }
+        i += w;
+    }
+}
+
+void device_cache::reserve(const std::string& filename, target_role role,
+        std::size_t offset, std::size_t length, std::size_t window)
+{
+    const std::size_t mask = static_cast<std::size_t>(target::page_size_) - 1;
+    std::size_t first = offset & ~mask;
+    std::size_t last = (offset + length + mask) & ~mask;
+
+    // in the same way as the constructor of target tells.
+    window = (window + mask) & ~mask;
+    if(0 < window && window < (offset & mask) + length){
+        return;
+    }
+    const std::size_t span = 0 < window ? window : max_span;
+
+    std::map<std::size_t, range>& ranges = ranges_[key(filename, role)];
+    auto begin = ranges.upper_bound(first);
+    if(begin != ranges.begin() && first <= std::prev(begin)->second.end){
+        --begin;
     }
-    for(unsigned int i = 0; i < jobs; ++i){
-        threads.at(i).join();
+    auto end = begin;
+    for(; end != ranges.end() && end->first <= last; ++end){
+        first = std::min(first, end->first);
+        last = std::max(last, end->second.end);
     }
-    const std::size_t round = len * jobs;
-    const std::size_t residue = count % jobs;
-    if(iohelper::pwrite(fd, b + round, residue, static_cast<off_t>(round)) == -1){
-        ERROR("pwrite");
+    // a range which would make the merged one too large is mapped on its own.
+    if(begin != end && span < last - first){
+        return;
     }
+    // the ranges merged are left mapped for the targets which use them already.
+    ranges.erase(begin, end);
+    ranges.emplace(first, range{last, nullptr});
+}
 
-    return static_cast<ssize_t>(count);
+std::shared_ptr<int> device_cache::open(const std::string& filename, target_role role)
+{
+    std::shared_ptr<int>& fd = fds_[key(filename, role)];
+    if(fd){
+        return fd;
+    }
+
+    const std::shared_ptr<int> opened(new int(target::iohelper::open(filename.c_str(),
+                    target::select_file_flags(role), S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)),
+            target::iohelper::close);
+    if(*opened != -1){
+        fd = opened;
+    }
+    return opened;
+}
+
+std::shared_ptr<char> device_cache::map(const key& k, int fd, int prot, std::size_t offset,
+        std::size_t length, bool regular_file, const mapping_policy& policy)
+{
+    const std::size_t mask = static_cast<std::size_t>(target::page_size_) - 1;
+    const std::size_t first = offset & ~mask;
+    const std::size_t last = offset + length;
+
+    std::map<std::size_t, range>& ranges = ranges_[k];
+    auto it = ranges.upper_bound(first);
+    if(it == ranges.begin() || std::prev(it)->second.end < last){
+        const std::size_t size = ((last + mask) & ~mask) - first;
+        void* m = map_pages(fd, size, prot, static_cast<off_t>(first), regular_file, policy);
+        if(m == MAP_FAILED){
+            ERROR_THROW("mmap");
+        }
+        return std::shared_ptr<char>(reinterpret_cast<char*>(m),
+                [size](char* p){stats::add_syscall(); ::munmap(p, size);});
+    }
+    --it;
+
+    range& r = it->second;
+    if(!r.data){
+        const std::size_t size = r.end - it->first;
+        void* m = map_pages(fd, size, prot, static_cast<off_t>(it->first), regular_file, policy);
+        if(m == MAP_FAILED){
+            ERROR_THROW("mmap");
+        }
+        r.data.reset(reinterpret_cast<char*>(m),
+                [size](char* p){stats::add_syscall(); ::munmap(p, size);});
+    }
+    return std::shared_ptr<char>(r.data, r.data.get() + (first - it->first));
 }
 
 // vim: set expandtab shiftwidth=0 tabstop=4 :
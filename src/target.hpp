@@ -1,11 +1,14 @@
 #ifndef TARGET_HPP_
 #define TARGET_HPP_
 
+#include <functional>
+#include <map>
 #include <memory>
 #include <string>
 #include <unistd.h>
 #include <sys/stat.h>
 #include "fwd.hpp"
+#include "mapping.hpp"
 
 enum class target_role{
     SRC,
@@ -20,18 +23,58 @@ enum class endian{
 
 endian to_endian(const std::string& str);
 
+// how the destination is synchronized after each transfer.
+enum class sync_mode{
+    FULL,
+    DATA,
+    NONE,
+};
+
+sync_mode to_sync_mode(const std::string& str);
+
 class target{
 public:
     target(const std::string& filename, target_role role,
-            std::size_t offset = 0ul, std::size_t length = 0ul);
+            std::size_t offset = 0ul, std::size_t length = 0ul,
+            const mapping_policy& policy = mapping_policy());
+    // shares the descriptor of 'filename' and the mapping of the range with
+    // the other targets constructed with 'cache'.
+    target(device_cache& cache, const std::string& filename, target_role role,
+            std::size_t offset, std::size_t length,
+            const mapping_policy& policy = mapping_policy());
     target(int fd);
+    // a SRC which generates 'p' into a mapped destination, instead of reading anything.
+    explicit target(const pattern& p);
     target(const target&) = default;
     ~target(){}
 
     int transfer_to(const target& dest, const param& prm)const;
-    int write_to(const target& dest, const param& prm)const;
+    // does the setup for transferring to 'dest' once, e.g. the scheduling policy,
+    // and resolves how to transfer. the returned function does the rest of
+    // transfer_to() each time it's called, as long as this, 'dest' and 'prm' live.
+    std::function<int()> compile(const target& dest, const param& prm)const;
+    // the data written is appended to 'sum', if any. 'lend' lets a pipe take the mapped
+    // pages by reference, which the reader may consume after this returns. so it's only
+    // for a region nothing writes in the meantime, which is_stable() tells.
+    int write_to(const target& dest, const param& prm, checksum* sum = nullptr,
+            bool lend = false)const;
+    // in the same way as compile(), resolves comparing the region with the one of 'other'
+    // on the jobs. the first --max-mismatches differing words at --width are written to
+    // 'out', unless it's -1. the returned function returns 0 if both are the same,
+    // or 'differ' otherwise, including when their lengths differ.
+    std::function<int()> compile_compare(const target& other, const param& prm, int out)const;
+    static constexpr int differ = -1;
+    // in the same way, resolves searching the region for --search on the jobs. the addresses
+    // of the matches are written to 'out' in order, a line each. the returned function
+    // returns 0 if any has been found, or 'not_found' otherwise.
+    std::function<int()> compile_search(const param& prm, int out)const;
+    static constexpr int not_found = -2;
 
     void mmap(int prot);
+    bool is_mapped()const{return mmapped_data_ || is_streamed();}
+    // whether this and 'other' may touch the same bytes of the same file.
+    // the ones not mapped, e.g. stdin or a file to be written, count as a whole.
+    bool overlaps(const target& other)const;
 
     // deprecated.
     char* offset()const{return mmapped_data_.get() + page_offset_;}
@@ -44,48 +87,126 @@ private:
     const std::size_t offset_;
     mutable std::size_t length_;
     const std::size_t page_offset_;
+    const mapping_policy policy_;
+    const std::size_t window_;
+    int prot_;
+    std::shared_ptr<const pattern> pattern_;
+
+    // called with the position and the length of a window in the regions,
+    // and the pointers to the window in the source and the destination.
+    // returning nonzero stops the walk, and the value is returned by stream().
+    using window_function = std::function<int(std::size_t pos, std::size_t n,
+            const char* src, char* dst)>;
+
+    target(const std::shared_ptr<int>& fd, const std::string& filename, target_role role,
+            std::size_t offset, std::size_t length, const mapping_policy& policy,
+            device_cache* cache);
 
     std::size_t init_length(std::size_t length, target_role role);
     void preprocess(target_role role);
-    int passthrough(const target& dest)const;
-
-    static int hexdump(int fd, const char* data, std::size_t offset,
-            std::size_t length, std::size_t page_offset, const param& prm);
+    int passthrough(const target& dest, const param& prm, checksum* sum)const;
+    int hexdump(const target& dest, const param& prm, checksum* sum)const;
+
+    bool is_regular_file()const{return S_ISREG(stat_.st_mode);}
+    // a range as small as a few registers, in a page mapped as a whole, which is
+    // accessed directly at --width, without any thread or buffer.
+    bool is_register()const
+    {
+        return mmapped_data_ && length_ <= max_register_size
+            && page_offset_ + length_ <= static_cast<std::size_t>(page_size_);
+    }
+    bool is_streamed()const{return !mmapped_data_ && prot_ != 0;}
+    // whether the region is only read in the run of 'prm', once, so that
+    // what is read stays the same until the process exits.
+    bool is_stable(const param& prm)const;
+    // points to 'pos' in the region, mapping [pos, pos + n) if not mapped as a whole.
+    // such a window is synchronized as it's unmapped if writable, unless 'sync' is false.
+    std::shared_ptr<char> view(std::size_t pos, std::size_t n, bool sync = true)const;
+
+    // walks [0, length) of the regions of 'src' and 'dst', either of which may be null.
+    static int stream(const target* src, const target* dst, std::size_t length,
+            const window_function& f, bool sync = true);
     static std::uint64_t fetch(const void* p, int width, endian e = endian::HOST);
     static int select_file_flags(target_role r);
 
     const static long page_size_;
+    static constexpr std::size_t max_register_size = 64;
 
-    class iohelper{
-    public:
-        iohelper(int fd, std::size_t size);
-        ~iohelper();
-
-        template <typename... Args>
-        int snprintf(const char* format, Args... args); // defined in .cpp file.
+    friend class device_cache;
 
+    class iohelper{
     public:
         static int open(const char* pathname, int flags, mode_t mode);
         static ssize_t read(int fd, void* buf, size_t count);
         static ssize_t write(int fd, const void* buf, size_t count);
         static ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset);
+        // these three take the file descriptors in the same order,
+        // and transfer from/to the current file offsets.
+        static ssize_t copy_file_range(int fd_in, int fd_out, size_t count);
+        static ssize_t sendfile(int fd_in, int fd_out, size_t count);
+        static ssize_t splice(int fd_in, int fd_out, size_t count);
+        // returns the number of bytes handed over to the pipe before an error, if any.
+        static ssize_t vmsplice(int fd, const void* buf, size_t count);
         static off_t lseek(int fd, off_t offset, int whence);
         static int ftruncate(int fd, off_t length);
         static void close(int*);
 
         static struct stat fstat(int fd);
 
-        static void *memcpy(void* dest, const void* src, size_t n,
-                int sched_policy, size_t jobs);
+        // these two append the data to 'sum', if any, as each chunk of it is copied
+        // by the thread which copies it.
+        static void *memcpy(void* dest, const void* src, size_t n, const param& prm,
+                checksum* sum = nullptr);
         static ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset,
-                int sched_policy, size_t jobs);
+                const param& prm, checksum* sum = nullptr);
+        // writes [pos, pos + n) of 'p' to 'dest' on the jobs, in the same way as memcpy().
+        static void fill(char* dest, const pattern& p, size_t pos, size_t n, const param& prm,
+                checksum* sum);
+        // same as write(), but copies the data through a buffer, which is appended to 'sum'.
+        static ssize_t write(int fd, const void* buf, size_t count, checksum& sum);
+        // copies n bytes with volatile accesses of 'width' bits, so that a device sees
+        // the access size, or of narrower ones where either side is not aligned to it.
+        static void copy_registers(char* dest, const char* src, std::size_t n, int width);
+    };
+};
+
+// shares a descriptor per file and role, and the mappings of ranges, among the
+// targets constructed with it. ranges reserved which overlap or adjoin each other
+// at page granularity are merged, and mapped at once on the first use.
+// the others are mapped on their own, so that the mappings don't grow with the use.
+class device_cache{
+public:
+    device_cache(): fds_(), ranges_(){}
+    device_cache(const device_cache&) = delete;
+    device_cache& operator=(const device_cache&) = delete;
+
+    // tells [offset, offset + length) of 'filename' is going to be used for 'role',
+    // so that it can be merged with the others before any of them is mapped.
+    // a range streamed through windows of 'window' bytes is not, as it's never mapped
+    // as a whole. the merged ranges span no more than the window, or max_span without.
+    void reserve(const std::string& filename, target_role role,
+            std::size_t offset, std::size_t length, std::size_t window = 0);
 
-    private:
-        const int fd_;
-        const std::size_t size_;
-        std::shared_ptr<char[]> buf_;
-        std::size_t count_;
+    static constexpr std::size_t max_span = 1ul << 26;
+
+private:
+    friend class target;
+
+    using key = std::pair<std::string, target_role>;
+    struct range{
+        std::size_t end;
+        std::shared_ptr<char> data; // null until the first use.
     };
+
+    std::shared_ptr<int> open(const std::string& filename, target_role role);
+    // returns the page which contains 'offset', in the mapping of the range
+    // which covers [offset, offset + length).
+    std::shared_ptr<char> map(const key& k, int fd, int prot, std::size_t offset,
+            std::size_t length, bool regular_file, const mapping_policy& policy);
+
+    std::map<key, std::shared_ptr<int>> fds_;
+    // disjoint ranges, keyed by their first byte, which is aligned to a page.
+    std::map<key, std::map<std::size_t, range>> ranges_;
 };
 
 #endif // TARGET_HPP_
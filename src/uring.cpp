@@ -0,0 +1,247 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "uring.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "misc.hpp"
+#include "stats.hpp"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+io_engine to_io_engine(const std::string& str)
+{
+    if(str == "threads"){
+        return io_engine::THREADS;
+    }else if(str == "uring"){
+        return io_engine::URING;
+    }else{
+        errno = EINVAL;
+        ERROR_THROW("invalid io engine");
+    }
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+template <typename T>
+static T* at(void* base, std::size_t offset)
+{
+    return static_cast<T*>(static_cast<void*>(static_cast<char*>(base) + offset));
+}
+
+uring::uring(unsigned depth)
+: depth_(depth), fd_(-1),
+sq_ring_(MAP_FAILED), sq_ring_size_(), cq_ring_(MAP_FAILED), cq_ring_size_(),
+sqes_(MAP_FAILED), sqes_size_(),
+sq_head_(), sq_tail_(), sq_mask_(), sq_array_(),
+cq_head_(), cq_tail_(), cq_mask_(), cqes_()
+{
+    struct io_uring_params p = {};
+    fd_ = static_cast<int>(syscall(__NR_io_uring_setup, depth, &p));
+    if(fd_ == -1){
+        ERROR_THROW("io_uring_setup");
+    }
+
+    sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    const bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap){
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+
+    sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    cq_ring_ = single_mmap ? sq_ring_ : ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    sqes_ = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if(sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes_ == MAP_FAILED){
+        const int error = errno;
+        release();
+        errno = error;
+        ERROR_THROW("mmap");
+    }
+
+    sq_head_  = at<unsigned>(sq_ring_, p.sq_off.head);
+    sq_tail_  = at<unsigned>(sq_ring_, p.sq_off.tail);
+    sq_mask_  = *at<unsigned>(sq_ring_, p.sq_off.ring_mask);
+    sq_array_ = at<unsigned>(sq_ring_, p.sq_off.array);
+    cq_head_  = at<unsigned>(cq_ring_, p.cq_off.head);
+    cq_tail_  = at<unsigned>(cq_ring_, p.cq_off.tail);
+    cq_mask_  = *at<unsigned>(cq_ring_, p.cq_off.ring_mask);
+    cqes_     = at<void>(cq_ring_, p.cq_off.cqes);
+
+    // IORING_OP_WRITE came with linux 5.6, as did the probe.
+    // older kernels take the probe as an invalid argument.
+    std::vector<char> buf(sizeof(struct io_uring_probe)
+            + IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+    struct io_uring_probe* probe = static_cast<struct io_uring_probe*>(static_cast<void*>(buf.data()));
+    if(syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == -1
+            || probe->last_op < IORING_OP_WRITE
+            || !(probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)){
+        release();
+        errno = EOPNOTSUPP;
+        ERROR_THROW("io_uring doesn't support IORING_OP_WRITE");
+    }
+}
+
+uring::~uring()
+{
+    release();
+}
+
+ssize_t uring::pwrite(int fd, const void* buf, std::size_t count, off_t offset, std::size_t block)
+{
+    const char* b = static_cast<const char*>(buf);
+
+    // the length of a write has to fit in sqe.len.
+    constexpr std::size_t max_block = 1ul << 30;
+    block = std::max(std::min(block, max_block), 1ul);
+
+    const auto block_end = [=](std::size_t pos){
+        return std::min(count, (pos / block + 1) * block);
+    };
+
+    // short writes are continued from where they stopped.
+    std::deque<std::size_t> retries;
+    std::size_t next = 0;
+    std::size_t inflight = 0;
+    // queued to the submission ring, but not yet taken by the kernel.
+    unsigned unsubmitted = 0;
+    int error = 0;
+
+    while(0 < inflight || (error == 0 && (next < count || !retries.empty()))){
+        unsigned tail = *sq_tail_;
+        while(error == 0 && inflight < depth_ && (next < count || !retries.empty())){
+            std::size_t pos = next;
+            if(retries.empty()){
+                next = block_end(next);
+            }else{
+                pos = retries.front();
+                retries.pop_front();
+            }
+
+            const unsigned index = tail & sq_mask_;
+            struct io_uring_sqe& sqe = static_cast<struct io_uring_sqe*>(sqes_)[index];
+            sqe = {};
+            sqe.opcode = IORING_OP_WRITE;
+            sqe.fd = fd;
+            sqe.off = static_cast<__u64>(offset) + pos;
+            sqe.addr = reinterpret_cast<__u64>(b + pos);
+            sqe.len = static_cast<__u32>(block_end(pos) - pos);
+            sqe.user_data = pos;
+            sq_array_[index] = index;
+
+            ++tail;
+            ++unsubmitted;
+            ++inflight;
+        }
+        __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+        const int submitted = enter(unsubmitted, 1);
+        if(submitted == -1){
+            // the kernel is short of memory or of room for completions. the rest
+            // is submitted after one of the writes already submitted is reaped.
+            if((errno != EAGAIN && errno != EBUSY) || unsubmitted == inflight
+                    || enter(0, 1) == -1){
+                error = errno;
+                break;
+            }
+        }else{
+            unsubmitted -= static_cast<unsigned>(submitted);
+        }
+
+        unsigned head = *cq_head_;
+        const unsigned cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for(; head != cq_tail; ++head){
+            const struct io_uring_cqe& cqe = static_cast<struct io_uring_cqe*>(cqes_)[head & cq_mask_];
+            --inflight;
+            const std::size_t pos = static_cast<std::size_t>(cqe.user_data);
+            if(cqe.res < 0){
+                error = error == 0 ? -cqe.res : error;
+            }else if(cqe.res == 0){
+                error = error == 0 ? ENOSPC : error;
+            }else if(pos + static_cast<std::size_t>(cqe.res) < block_end(pos)){
+                retries.push_back(pos + static_cast<std::size_t>(cqe.res));
+            }
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+    if(error != 0){
+        errno = error;
+        return -1;
+    }
+    return static_cast<ssize_t>(count);
+}
+
+void uring::release()
+{
+    if(sqes_ != MAP_FAILED){
+        ::munmap(sqes_, sqes_size_);
+    }
+    if(cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_){
+        ::munmap(cq_ring_, cq_ring_size_);
+    }
+    if(sq_ring_ != MAP_FAILED){
+        ::munmap(sq_ring_, sq_ring_size_);
+    }
+    if(0 <= fd_){
+        ::close(fd_);
+    }
+}
+
+int uring::enter(unsigned to_submit, unsigned min_complete)
+{
+    while(true){
+        stats::add_syscall();
+        const long ret = syscall(__NR_io_uring_enter, fd_, to_submit, min_complete,
+                IORING_ENTER_GETEVENTS, nullptr, 0);
+        if(ret != -1 || errno != EINTR){
+            return static_cast<int>(ret);
+        }
+    }
+}
+
+#else
+
+uring::uring(unsigned depth)
+: depth_(depth), fd_(-1),
+sq_ring_(), sq_ring_size_(), cq_ring_(), cq_ring_size_(),
+sqes_(), sqes_size_(),
+sq_head_(), sq_tail_(), sq_mask_(), sq_array_(),
+cq_head_(), cq_tail_(), cq_mask_(), cqes_()
+{
+    errno = ENOSYS;
+    ERROR_THROW("io_uring is not available");
+}
+
+uring::~uring(){}
+
+ssize_t uring::pwrite(int, const void*, std::size_t, off_t, std::size_t)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+void uring::release(){}
+
+int uring::enter(unsigned, unsigned)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
@@ -0,0 +1,61 @@
+#ifndef URING_HPP_
+#define URING_HPP_
+
+#include <cstddef>
+#include <string>
+#include <sys/types.h>
+
+enum class io_engine{
+    THREADS,
+    URING,
+};
+
+io_engine to_io_engine(const std::string& str);
+
+// an io_uring instance, driven through the raw system calls.
+class uring{
+public:
+    // throws if the kernel doesn't provide io_uring, or its IORING_OP_WRITE.
+    explicit uring(unsigned depth);
+    uring(const uring&) = delete;
+    uring& operator=(const uring&) = delete;
+    ~uring();
+
+    unsigned depth()const{return depth_;}
+
+    // writes 'count' bytes to 'fd' from 'offset', in writes of 'block' bytes,
+    // keeping up to depth() of them in flight. neither 'buf' nor 'fd' is registered
+    // to the ring: a registration outliving the call could refer to pages or a file
+    // no longer behind the same address or descriptor, and one per call costs more
+    // than it saves. returns -1 on failure with errno set. the writes in flight are
+    // waited for before returning, unless the ring itself fails.
+    ssize_t pwrite(int fd, const void* buf, std::size_t count, off_t offset, std::size_t block);
+
+private:
+    void release();
+    // returns the number of entries submitted, or -1 with errno set.
+    int enter(unsigned to_submit, unsigned min_complete);
+
+    const unsigned depth_;
+    int fd_;
+
+    void* sq_ring_;
+    std::size_t sq_ring_size_;
+    void* cq_ring_;
+    std::size_t cq_ring_size_;
+    void* sqes_;
+    std::size_t sqes_size_;
+
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned sq_mask_;
+    unsigned* sq_array_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    void* cqes_;
+};
+
+#endif // URING_HPP_
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
@@ -0,0 +1,296 @@
+#include "workerpool.hpp"
+
+#include <algorithm>
+#include "misc.hpp"
+#include "sched.hpp"
+#include "sighandler.hpp"
+#include "stats.hpp"
+
+worker_pool& worker_pool::instance(int sched_policy, std::size_t jobs,
+        const std::vector<int>& cpus)
+{
+    static worker_pool pool;
+    if(1 < jobs){
+        pool.grow(sched_policy, jobs - 1, cpus);
+    }
+    return pool;
+}
+
+worker_pool::worker_pool()
+: mutex_(),
+wakeup_(),
+queue_(),
+threads_(),
+stopped_(),
+starting_(),
+start_error_(),
+started_()
+{}
+
+worker_pool::~worker_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    wakeup_.notify_all();
+    for(auto& th: threads_){
+        th.join();
+    }
+}
+
+void worker_pool::run(std::size_t count, std::size_t jobs,
+        const std::function<void(std::size_t)>& task)
+{
+    if(count == 0){
+        return;
+    }
+
+    std::shared_ptr<batch> b = std::make_shared<batch>(count, jobs - 1, task);
+
+    const std::size_t workers = size();
+    const bool shared = 1 < count && 1 < jobs && 0 < workers;
+    stats::add_threads(shared ? std::min({count, jobs, workers + 1}) : 1);
+    if(shared){
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(b);
+        }
+        wakeup_.notify_all();
+    }
+
+    // the calling thread takes part in the batch instead of just waiting for it.
+    b->work();
+
+    if(shared){
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = std::find(queue_.begin(), queue_.end(), b);
+        if(it != queue_.end()){
+            queue_.erase(it);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(b->mutex_);
+    b->finished_.wait(lock, [&b]{return b->done_ == b->count_;});
+    if(b->error_){
+        std::rethrow_exception(b->error_);
+    }
+}
+
+void worker_pool::run_chunked(std::size_t origin, std::size_t n, std::size_t chunk,
+        std::size_t jobs, const std::function<void(std::size_t first, std::size_t last)>& task)
+{
+    const std::size_t head = origin % chunk;
+    const std::size_t count = (head + n + chunk - 1) / chunk;
+    const std::size_t workers = std::min(count, jobs);
+    if(workers <= 1){
+        if(0 < n){
+            task(0, n);
+        }
+        return;
+    }
+
+    chunk_scheduler scheduler(count, workers);
+    run(workers, workers, [&](std::size_t worker){
+        for(std::size_t i; scheduler.next(worker, i);){
+            task(i == 0 ? 0 : i * chunk - head, std::min((i + 1) * chunk - head, n));
+        }
+    });
+}
+
+std::size_t worker_pool::size()const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return threads_.size();
+}
+
+worker_pool::batch::batch(std::size_t count, std::size_t helpers,
+        const std::function<void(std::size_t)>& task)
+: count_(count),
+helpers_(helpers),
+helping_(),
+task_(task),
+next_(),
+done_(),
+error_(),
+mutex_(),
+finished_()
+{}
+
+void worker_pool::batch::work()
+{
+    std::size_t i;
+    while((i = next_.fetch_add(1)) < count_){
+        try{
+            task_(i);
+        }catch(...){
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(!error_){
+                error_ = std::current_exception();
+            }
+        }
+        if(done_.fetch_add(1) + 1 == count_){
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished_.notify_all();
+        }
+    }
+}
+
+void worker_pool::grow(int sched_policy, std::size_t workers, const std::vector<int>& cpus)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if(workers <= threads_.size()){
+        return;
+    }
+
+    start_error_ = nullptr;
+    starting_ = workers - threads_.size();
+    while(threads_.size() < workers){
+        const int cpu = cpus.empty() ? -1 : cpus.at((threads_.size() + 1) % cpus.size());
+        threads_.emplace_back(&worker_pool::worker, this, sched_policy, cpu);
+    }
+
+    started_.wait(lock, [this]{return starting_ == 0;});
+    if(start_error_){
+        std::rethrow_exception(start_error_);
+    }
+}
+
+void worker_pool::worker(int sched_policy, int cpu)
+{
+    bool ready = true;
+    try{
+        if(0 <= cpu){
+            set_cpu_affinity(cpu);
+        }
+        set_scheduling_policy(sched_policy);
+        set_signal_handler();
+    }catch(...){
+        ready = false;
+        std::lock_guard<std::mutex> lock(mutex_);
+        start_error_ = std::current_exception();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --starting_;
+    }
+    started_.notify_all();
+
+    if(!ready){
+        return;
+    }
+
+    while(true){
+        std::shared_ptr<batch> b;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wakeup_.wait(lock, [this, &b]{return stopped_ || (b = next_batch());});
+            if(stopped_){
+                return;
+            }
+            ++b->helping_;
+        }
+        b->work();
+    }
+}
+
+std::shared_ptr<worker_pool::batch> worker_pool::next_batch()
+{
+    for(auto it = queue_.begin(); it != queue_.end();){
+        if((*it)->count_ <= (*it)->next_){
+            // every task of this batch has been taken already.
+            it = queue_.erase(it);
+        }else if((*it)->helping_ < (*it)->helpers_){
+            return *it;
+        }else{
+            ++it;
+        }
+    }
+    return nullptr;
+}
+
+background_thread& background_thread::instance()
+{
+    static background_thread th;
+    return th;
+}
+
+background_thread::background_thread()
+: mutex_(),
+wakeup_(),
+queue_(),
+stopped_(),
+thread_([this]{run();})
+{}
+
+background_thread::~background_thread()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    wakeup_.notify_all();
+    thread_.join();
+}
+
+void background_thread::push(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(task));
+    }
+    wakeup_.notify_all();
+}
+
+void background_thread::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while(true){
+        wakeup_.wait(lock, [this]{return stopped_ || !queue_.empty();});
+        if(queue_.empty()){
+            return;
+        }
+        std::function<void()> task = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+chunk_scheduler::chunk_scheduler(std::size_t count, std::size_t workers)
+: deques_(workers)
+{
+    // each worker starts with a contiguous share, to touch its pages first.
+    for(std::size_t i = 0; i < workers; ++i){
+        const std::uint64_t front = count * i / workers;
+        const std::uint64_t back = count * (i + 1) / workers;
+        deques_[i].range.store(front << 32 | back, std::memory_order_relaxed);
+    }
+}
+
+bool chunk_scheduler::next(std::size_t worker, std::size_t& index)
+{
+    // its own deque from the front, and then the others' from the back.
+    for(std::size_t k = 0; k < deques_.size(); ++k){
+        std::atomic<std::uint64_t>& range = deques_[(worker + k) % deques_.size()].range;
+        std::uint64_t r = range.load(std::memory_order_relaxed);
+        while(true){
+            const std::uint64_t front = r >> 32;
+            const std::uint64_t back = r & 0xffffffffu;
+            if(back <= front){
+                break;
+            }
+            const std::uint64_t taken = k == 0 ? front : back - 1;
+            const std::uint64_t rest = k == 0 ? (front + 1) << 32 | back : front << 32 | (back - 1);
+            if(range.compare_exchange_weak(r, rest, std::memory_order_acq_rel)){
+                index = static_cast<std::size_t>(taken);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
@@ -0,0 +1,139 @@
+#ifndef WORKERPOOL_HPP_
+#define WORKERPOOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class worker_pool{
+public:
+    // returns the process-wide pool, growing it so that 'jobs' threads
+    // (the calling thread included) can work at once.
+    // the scheduling policy is applied only to the threads created by this call.
+    // if 'cpus' is not empty, the k-th pool thread is pinned to cpus[k % cpus.size()],
+    // leaving cpus[0] to the calling thread.
+    static worker_pool& instance(int sched_policy, std::size_t jobs,
+            const std::vector<int>& cpus = {});
+
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+    ~worker_pool();
+
+    // calls task(0), task(1), ..., task(count - 1) on no more than 'jobs' threads,
+    // the calling thread included, and returns when all of them have finished.
+    // tasks are started in the order of their indices.
+    // the first exception thrown by a task is rethrown here.
+    void run(std::size_t count, std::size_t jobs,
+            const std::function<void(std::size_t)>& task);
+    // calls task(first, last) for each chunk of [0, n) on no more than 'jobs' threads.
+    // the chunks end at multiples of 'chunk' counted from 'origin', so that no page is
+    // shared by two of them if 'chunk' is a multiple of the page size. each thread takes
+    // its own contiguous share of them from the front, then steals from the back of the
+    // others', so that a slow chunk holds up no more than the thread copying it.
+    void run_chunked(std::size_t origin, std::size_t n, std::size_t chunk, std::size_t jobs,
+            const std::function<void(std::size_t first, std::size_t last)>& task);
+
+    std::size_t size()const;
+
+private:
+    struct batch{
+        batch(std::size_t count, std::size_t helpers,
+                const std::function<void(std::size_t)>& task);
+
+        void work();
+
+        const std::size_t count_;
+        const std::size_t helpers_;
+        std::size_t helping_; // guarded by worker_pool::mutex_.
+        const std::function<void(std::size_t)>& task_;
+        std::atomic<std::size_t> next_;
+        std::atomic<std::size_t> done_;
+        std::exception_ptr error_;
+        std::mutex mutex_;
+        std::condition_variable finished_;
+    };
+
+    worker_pool();
+
+    void grow(int sched_policy, std::size_t workers, const std::vector<int>& cpus);
+    void worker(int sched_policy, int cpu);
+    std::shared_ptr<batch> next_batch();
+
+    mutable std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::deque<std::shared_ptr<batch>> queue_;
+    std::vector<std::thread> threads_;
+    bool stopped_;
+
+    std::size_t starting_;
+    std::exception_ptr start_error_;
+    std::condition_variable started_;
+};
+
+// runs tasks one by one, in the order of submission, on a single thread kept for
+// the whole process, so that work overlapped with the calling thread does not
+// start a thread each time.
+class background_thread{
+public:
+    static background_thread& instance();
+
+    background_thread(const background_thread&) = delete;
+    background_thread& operator=(const background_thread&) = delete;
+    ~background_thread();
+
+    // the result, or the exception thrown by 'f', is handed through the returned future.
+    // the future does not wait for 'f' when it is destroyed, so whatever 'f' refers to
+    // has to outlive it, or be waited for.
+    template<typename F>
+    auto submit(F f) -> std::future<decltype(f())>
+    {
+        const auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+        std::future<decltype(f())> result = task->get_future();
+        push([task]{(*task)();});
+        return result;
+    }
+
+private:
+    background_thread();
+
+    void push(std::function<void()> task);
+    void run();
+
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::deque<std::function<void()>> queue_;
+    bool stopped_;
+    std::thread thread_;
+};
+
+// hands out the indices [0, count) to 'workers' workers through a deque per worker.
+// the deques are packed into single words, so that taking an index costs an atomic
+// operation on the worker's own cache line, unless it has to steal.
+class chunk_scheduler{
+public:
+    chunk_scheduler(std::size_t count, std::size_t workers);
+
+    // takes the next index for 'worker' into 'index'. returns false if none is left.
+    bool next(std::size_t worker, std::size_t& index);
+
+private:
+    struct alignas(64) deque{
+        // the front in the upper half, and the back in the lower half.
+        std::atomic<std::uint64_t> range;
+    };
+
+    std::vector<deque> deques_;
+};
+
+#endif // WORKERPOOL_HPP_
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
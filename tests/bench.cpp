@@ -0,0 +1,234 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "common.hpp"
+#include "misc.hpp"
+#include "target.hpp"
+#include "uring.hpp"
+
+// measures the transfer paths of masterkey, and prints the results in JSON.
+// a memfd stands in for /dev/mem, so that no root privilege is needed.
+// nothing is printed to stdout unless all of them succeed.
+
+const char* progname = nullptr;
+
+namespace{
+
+struct options{
+    std::vector<std::size_t> sizes{1ul << 20, 16ul << 20, 64ul << 20};
+    std::vector<std::size_t> jobs{1, 2, 4};
+    std::vector<std::size_t> widths{8, 32, 64};
+    double min_seconds = 0.2;
+    std::size_t min_iterations = 3;
+};
+
+struct result{
+    std::size_t iterations;
+    double seconds;
+    double cpu_seconds;
+    double min_latency;
+    double max_latency;
+};
+
+std::vector<std::size_t> to_list(const std::string& str)
+{
+    std::vector<std::size_t> list;
+    for(std::size_t pos = 0, end = 0; end < str.size(); pos = end + 1){
+        end = std::min(str.find(',', pos), str.size());
+        std::size_t idx = 0;
+        std::size_t n = std::stoul(str.substr(pos, end - pos), &idx, 0);
+        switch(pos + idx < end ? str.at(pos + idx) : '\0'){
+        case 'k': case 'K': n <<= 10; break;
+        case 'm': case 'M': n <<= 20; break;
+        case 'g': case 'G': n <<= 30; break;
+        default: break;
+        }
+        list.push_back(n);
+    }
+    return list;
+}
+
+double cpu_time()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+        + static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// calls 'prepare' and 'run' alternately, timing only 'run', until both
+// the minimum time and the minimum number of iterations have passed.
+template<typename Prepare, typename Run>
+result measure(const options& opts, Prepare prepare, Run run)
+{
+    using clock = std::chrono::steady_clock;
+    result r = {0, 0.0, 0.0, 0.0, 0.0};
+    while(r.iterations < opts.min_iterations || r.seconds < opts.min_seconds){
+        prepare();
+        const double cpu = cpu_time();
+        const clock::time_point start = clock::now();
+        run();
+        const double latency = std::chrono::duration<double>(clock::now() - start).count();
+        r.cpu_seconds += cpu_time() - cpu;
+
+        r.min_latency = r.iterations == 0 ? latency : std::min(r.min_latency, latency);
+        r.max_latency = std::max(r.max_latency, latency);
+        r.seconds += latency;
+        ++r.iterations;
+    }
+    return r;
+}
+
+// throws if a transfer failed, so that its timing is not taken as a result.
+void check(int ret, const char* path)
+{
+    if(ret != 0){
+        throw std::runtime_error(std::string(path) + ": transfer failed");
+    }
+}
+
+void print(std::string& json, const char* path, const char* engine, std::size_t size,
+        std::size_t jobs, std::size_t width, const result& r)
+{
+    const double n = static_cast<double>(r.iterations);
+    char buf[512];
+    std::snprintf(buf, sizeof(buf), "%s\n    {\"path\": \"%s\", \"engine\": \"%s\", \"size\": %zu, \"jobs\": %zu, "
+            "\"width\": %zu, \"iterations\": %zu, \"gbps\": %.3f, "
+            "\"latency_ns\": {\"min\": %.0f, \"mean\": %.0f, \"max\": %.0f}, "
+            "\"cpu_ns\": %.0f}",
+            json.empty() ? "" : ",", path, engine, size, jobs, width, r.iterations,
+            static_cast<double>(size) * n / r.seconds / 1e9,
+            r.min_latency * 1e9, r.seconds / n * 1e9, r.max_latency * 1e9,
+            r.cpu_seconds / n * 1e9);
+    json += buf;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    progname = argv[0];
+
+    options opts;
+    int c;
+    while((c = getopt(argc, argv, "s:j:w:t:")) != -1){
+        switch(c){
+        case 's': opts.sizes = to_list(optarg); break;
+        case 'j': opts.jobs = to_list(optarg); break;
+        case 'w': opts.widths = to_list(optarg); break;
+        case 't': opts.min_seconds = std::stod(optarg); break;
+        default:
+            std::fprintf(stderr, "Usage: %s [-s SIZES] [-j JOBS] [-w WIDTHS] [-t SECONDS]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    const char* tmpdir = std::getenv("TMPDIR") ? std::getenv("TMPDIR") : "/tmp";
+    const std::string in_file = std::string(tmpdir) + "/masterkey-bench-in.bin";
+    const std::string out_file = std::string(tmpdir) + "/masterkey-bench-out.bin";
+    const std::size_t max_size = *std::max_element(opts.sizes.begin(), opts.sizes.end());
+
+    // the device holds the source region followed by the destination region.
+    const int memfd = memfd_create("masterkey-bench", 0);
+    if(memfd == -1 || ftruncate(memfd, static_cast<off_t>(2 * max_size)) == -1){
+        ERROR("memfd");
+    }
+    const std::string device = "/proc/self/fd/" + std::to_string(memfd);
+
+    try{
+        {
+            target init(device, target_role::DST, 0, max_size);
+            for(std::size_t i = 0; i < max_size; ++i){
+                init.offset()[i] = static_cast<char>(i * 7 + i / 4096);
+            }
+        }
+
+        std::string json;
+        for(std::size_t size: opts.sizes){
+            const target src(device, target_role::SRC, 0, size);
+            {
+                target in(in_file, target_role::DST);
+                check(src.write_to(in, param()), "setup");
+            }
+
+            for(std::size_t jobs: opts.jobs){
+                param prm;
+                prm.jobs = static_cast<int>(jobs);
+
+                {
+                    const target dst(device, target_role::DST, max_size, size);
+                    print(json, "memcpy", "threads", size, jobs, 0, measure(opts, []{},
+                                [&]{check(src.transfer_to(dst, prm), "memcpy");}));
+
+                    // the first half of the destination is dropped before each run, so
+                    // that it faults page by page while the second half is resident.
+                    // the longer the slowest job takes, the worse the tail latency gets.
+                    print(json, "memcpy-uneven", "threads", size, jobs, 0, measure(opts,
+                                [&]{
+                                    if(fallocate(memfd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                                static_cast<off_t>(max_size),
+                                                static_cast<off_t>(size / 2)) == -1){
+                                        ERROR_THROW("fallocate");
+                                    }
+                                },
+                                [&]{check(src.transfer_to(dst, prm), "memcpy-uneven");}));
+                }
+
+                for(io_engine engine: {io_engine::THREADS, io_engine::URING}){
+                    prm.engine = engine;
+                    std::unique_ptr<target> dst;
+                    print(json, "pwrite", engine == io_engine::URING ? "uring" : "threads",
+                            size, jobs, 0, measure(opts,
+                                [&]{dst.reset(); dst.reset(new target(out_file, target_role::DST));},
+                                [&]{check(src.transfer_to(*dst, prm), "pwrite");}));
+                }
+                prm.engine = io_engine::THREADS;
+
+                {
+                    const int fd = open(in_file.c_str(), O_RDONLY);
+                    if(fd == -1){
+                        ERROR(in_file);
+                    }
+                    std::unique_ptr<target> dst;
+                    print(json, "passthrough", "kernel", size, jobs, 0, measure(opts,
+                                [&]{dst.reset(); dst.reset(new target(out_file, target_role::DST));},
+                                [&]{check(target(fd).transfer_to(*dst, prm), "passthrough");}));
+                    close(fd);
+                }
+
+                prm.hexdump_enabled = true;
+                for(std::size_t width: opts.widths){
+                    prm.width = static_cast<int>(width);
+                    const target dst("/dev/null", target_role::DST);
+                    print(json, "hexdump", "threads", size, jobs, width, measure(opts, []{},
+                                [&]{check(src.transfer_to(dst, prm), "hexdump");}));
+                }
+            }
+        }
+        std::printf("{\"benchmarks\": [%s\n]}\n", json.c_str());
+    }catch(const std::exception& e){
+        std::fprintf(stderr, "%s: %s\n", progname, e.what());
+        unlink(in_file.c_str());
+        unlink(out_file.c_str());
+        return EXIT_FAILURE;
+    }
+
+    unlink(in_file.c_str());
+    unlink(out_file.c_str());
+    return EXIT_SUCCESS;
+}
+
+// vim: set expandtab shiftwidth=0 tabstop=4 :
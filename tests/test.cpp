@@ -1,18 +1,43 @@
+#include <atomic>
+#include <cctype>
+#include <cstdio>
 #include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
 #include <thread>
+#include <fcntl.h>
+#include <sched.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <signal.h>
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 #include "gtest/gtest.h"
 
+#include "autotune.hpp"
+#include "checksum.hpp"
 #include "common.hpp"
+#include "copykernel.hpp"
+#include "executor.hpp"
+#include "hexdump.hpp"
+#include "histogram.hpp"
+#include "mapping.hpp"
 #include "option.hpp"
+#include "pattern.hpp"
+#include "sched.hpp"
+#include "search.hpp"
+#include "server.hpp"
+#include "stats.hpp"
 #include "target.hpp"
+#include "uring.hpp"
+#include "workerpool.hpp"
 
-const char* progname = nullptr;
+const char* progname = "testsuite";
 
 int main(int argc, char* argv[])
 {
@@ -20,6 +45,37 @@ int main(int argc, char* argv[])
     return RUN_ALL_TESTS();
 }
 
+// writes 'data' at 'offset' of 'file'.
+static void write_file(const char* file, const std::string& data, off_t offset = 0)
+{
+    const int fd = open(file, O_WRONLY);
+    ASSERT_NE(fd, -1);
+    EXPECT_EQ(pwrite(fd, data.data(), data.size(), offset), static_cast<ssize_t>(data.size()));
+    close(fd);
+}
+
+// creates 'file' of 'size' zeros, replacing the existing one, and writes 'data' at 'offset' of it.
+static void create_file(const char* file, off_t size, const std::string& data = "", off_t offset = 0)
+{
+    const int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    ASSERT_NE(fd, -1);
+    EXPECT_EQ(ftruncate(fd, size), 0);
+    EXPECT_EQ(pwrite(fd, data.data(), data.size(), offset), static_cast<ssize_t>(data.size()));
+    close(fd);
+}
+
+// reads 'n' bytes at 'offset' of 'file'. less is returned at its end.
+static std::string read_file(const char* file, std::size_t n, off_t offset = 0)
+{
+    std::string data(n, '\0');
+    const int fd = open(file, O_RDONLY);
+    EXPECT_NE(fd, -1);
+    const ssize_t ret = pread(fd, &data[0], n, offset);
+    close(fd);
+    data.resize(ret < 0 ? 0 : static_cast<std::size_t>(ret));
+    return data;
+}
+
 class ParseTest: public ::testing::Test{
 protected:
     ParseTest(): parser(argc_, const_cast<char**>(argv_)){}
@@ -54,6 +110,32 @@ TEST_F(ParseTest, ParseTransferTest)
 
     EXPECT_THROW(parser.parse_transfer(":/source/is/missing", src, dst), std::runtime_error);
     EXPECT_THROW(parser.parse_transfer("/dest/is/missing:", src, dst), std::runtime_error);
+
+    EXPECT_NO_THROW(parser.parse_transfer("0x1f@0:a:b", src, dst));
+    EXPECT_EQ(src, "0x1f@0");
+    EXPECT_EQ(dst, "a:b");
+
+    EXPECT_NO_THROW(parser.parse_transfer("a:b:c:", src, dst));
+    EXPECT_EQ(src, "a:b");
+    EXPECT_EQ(dst, "c:");
+
+    EXPECT_THROW(parser.parse_transfer("no-colon", src, dst), std::runtime_error);
+    EXPECT_THROW(parser.parse_transfer("with space:a", src, dst), std::runtime_error);
+
+    // SRC "=" REF, which is looked for only without ":".
+    bool compare = true;
+    EXPECT_NO_THROW(parser.parse_transfer("1@23:a=b", src, dst, compare));
+    EXPECT_FALSE(compare);
+    EXPECT_EQ(dst, "a=b");
+    EXPECT_NO_THROW(parser.parse_transfer("1@23=4@56", src, dst, compare));
+    EXPECT_TRUE(compare);
+    EXPECT_EQ(src, "1@23");
+    EXPECT_EQ(dst, "4@56");
+    EXPECT_NO_THROW(parser.parse_transfer("a=b=c", src, dst, compare));
+    EXPECT_EQ(src, "a=b");
+    EXPECT_EQ(dst, "c");
+    EXPECT_THROW(parser.parse_transfer("=a", src, dst, compare), std::runtime_error);
+    EXPECT_THROW(parser.parse_transfer("1@23=4@56", src, dst), std::runtime_error);
 }
 
 TEST_F(ParseTest, ParseRangeTest)
@@ -98,6 +180,411 @@ TEST_F(ParseTest, ParseRangeTest)
 
     EXPECT_THROW(parser.parse_range("an_illegal_notation",
                 offset, length), std::runtime_error);
+    EXPECT_THROW(parser.parse_range("0x@1", offset, length), std::runtime_error);
+    EXPECT_THROW(parser.parse_range("1@", offset, length), std::runtime_error);
+    EXPECT_THROW(parser.parse_range("1kk@1", offset, length), std::runtime_error);
+    EXPECT_THROW(parser.parse_range("1@2@3", offset, length), std::runtime_error);
+}
+
+TEST(OptionTest, FromFileTest)
+{
+    const char* file = "transfers.txt";
+    std::ofstream(file) << "0x10@0:0x10@0x1000\n  0x20@0x10:0x20@0x2000\t0x30@0:0x30@0\n";
+    const char* device = "device.bin";
+    create_file(device, 0x3000);
+
+    const char* argv[] = {"cmd", "--device", device, "--from-file", file, "0x40@0:0x40@0", nullptr};
+    optind = 0;
+    std::shared_ptr<param> prm = option_parser(6, const_cast<char**>(argv)).parse_cmdopt();
+    ASSERT_EQ(prm->transfers.size(), 4u);
+    EXPECT_EQ(prm->transfers.at(0).src->length(), 0x40u);
+    EXPECT_EQ(prm->transfers.at(1).src->length(), 0x10u);
+    EXPECT_EQ(prm->transfers.at(2).dst->length(), 0x20u);
+    EXPECT_EQ(prm->transfers.at(3).src->length(), 0x30u);
+    unlink(file);
+    unlink(device);
+
+    const char* missing[] = {"cmd", "--from-file", "no/such/file", nullptr};
+    optind = 0;
+    EXPECT_THROW(option_parser(3, const_cast<char**>(missing)).parse_cmdopt(), std::runtime_error);
+}
+
+TEST(SchedTest, CpuListTest)
+{
+    EXPECT_EQ(to_cpu_list("3"), std::vector<int>({3}));
+    EXPECT_EQ(to_cpu_list("0-3,8,10-11"), std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+
+    EXPECT_THROW(to_cpu_list(""), std::runtime_error);
+    EXPECT_THROW(to_cpu_list("1,"), std::runtime_error);
+    EXPECT_THROW(to_cpu_list("3-1"), std::runtime_error);
+    EXPECT_THROW(to_cpu_list("a-b"), std::runtime_error);
+    EXPECT_THROW(to_cpu_list("-1"), std::runtime_error);
+
+    // -j auto allows as many threads as the cpus given, or the ones allowed.
+    EXPECT_GE(count_allowed_cpus(), 1);
+    const char* argv[] = {"cmd", "-j", "auto", "--cpus", "0-2", nullptr};
+    optind = 0;
+    EXPECT_EQ(option_parser(5, const_cast<char**>(argv)).parse_cmdopt()->jobs, 3);
+    optind = 0;
+    EXPECT_EQ(option_parser(3, const_cast<char**>(argv)).parse_cmdopt()->jobs, count_allowed_cpus());
+}
+
+TEST(AutotuneTest, SplitCopyTest)
+{
+    param prm;
+    prm.jobs = 4;
+    EXPECT_EQ(split_copy(4, copy_destination::MEMORY, prm).jobs, 4u);
+    EXPECT_EQ(split_copy(0x100000, copy_destination::MEMORY, prm).chunk_size, 0x8000u);
+    prm.chunk_size = 0x1001;
+    EXPECT_EQ(split_copy(0x100000, copy_destination::MEMORY, prm).chunk_size, 0x2000u);
+    prm.chunk_size = 0;
+
+    // the calibration for 4 jobs is taken from the cache, and one for 3 jobs is measured.
+    const std::string dir = "xdg-cache";
+    const std::string file = dir + "/masterkey/calibration";
+    setenv("XDG_CACHE_HOME", dir.c_str(), 1);
+    EXPECT_EQ(calibration::path(), file);
+    mkdir(dir.c_str(), 0755);
+    mkdir((dir + "/masterkey").c_str(), 0755);
+    std::ofstream(file) << "# comment\njobs 4\nkernel 0\nmemory 65536\nfile 1048576\n";
+
+    prm.auto_jobs = true;
+    EXPECT_EQ(split_copy(4, copy_destination::MEMORY, prm).jobs, 1u);
+    EXPECT_EQ(split_copy(0xffff, copy_destination::MEMORY, prm).jobs, 1u);
+    EXPECT_EQ(split_copy(0x10000, copy_destination::MEMORY, prm).jobs, 2u);
+    EXPECT_EQ(split_copy(0x100000, copy_destination::MEMORY, prm).jobs, 4u);
+    EXPECT_EQ(split_copy(0x80000, copy_destination::DESCRIPTOR, prm).jobs, 1u);
+    EXPECT_EQ(split_copy(0x200000, copy_destination::DESCRIPTOR, prm).jobs, 4u);
+
+    prm.jobs = 3;
+    const std::size_t jobs = split_copy(64ul << 20, copy_destination::MEMORY, prm).jobs;
+    EXPECT_GE(jobs, 1u);
+    EXPECT_LE(jobs, 3u);
+    std::ifstream ifs(file);
+    std::string key;
+    std::size_t value = 0;
+    while(ifs >> key && key != "jobs"){}
+    EXPECT_TRUE(ifs >> value);
+    EXPECT_EQ(value, 3u);
+
+    unsetenv("XDG_CACHE_HOME");
+    unlink(file.c_str());
+    rmdir((dir + "/masterkey").c_str());
+    rmdir(dir.c_str());
+}
+
+TEST(ChecksumTest, CombineTest)
+{
+    EXPECT_EQ(to_checksum_algorithm("crc32c"), checksum_algorithm::CRC32C);
+    EXPECT_THROW(to_checksum_algorithm("md5"), std::runtime_error);
+    EXPECT_NE(checksum(checksum_algorithm::AUTO).algorithm(), checksum_algorithm::AUTO);
+
+    const char check[] = "123456789";
+    EXPECT_EQ(checksum(checksum_algorithm::CRC32C).compute(check, 9), 0xe3069283u);
+
+    std::vector<unsigned char> data(100000);
+    for(std::size_t i = 0; i < data.size(); ++i){
+        data[i] = static_cast<unsigned char>(i * 7 + (i >> 9));
+    }
+    for(checksum_algorithm algorithm: {checksum_algorithm::CRC32C, checksum_algorithm::HASH64}){
+        checksum sum(algorithm);
+        const std::uint64_t whole = sum.compute(data.data(), data.size());
+        for(std::size_t first: {0ul, 1ul, 15ul, 16ul, 4097ul, 99999ul, 100000ul}){
+            sum.reset();
+            sum.update(data.data(), first);
+            sum.update(data.data() + first, data.size() - first);
+            EXPECT_EQ(sum.value(), whole);
+        }
+        // leading zeros count.
+        const char zeros[2] = {};
+        EXPECT_NE(sum.compute(zeros, 1), sum.compute(zeros, 2));
+    }
+}
+
+TEST(CopyKernelTest, CopyTest)
+{
+    std::vector<char> src(1 << 16);
+    for(std::size_t i = 0; i < src.size(); ++i){
+        src[i] = static_cast<char>(i * 7 + i / 251);
+    }
+
+    for(copy_kernel k: {copy_kernel::AUTO, copy_kernel::PORTABLE,
+            copy_kernel::SSE2, copy_kernel::AVX2, copy_kernel::AVX512}){
+        if(!is_supported(k)){
+            EXPECT_THROW(select_copy_kernel(k), std::runtime_error);
+            continue;
+        }
+        const copy_function copy = select_copy_kernel(k);
+        for(bool nontemporal: {false, true}){
+            for(std::size_t n: {0ul, 1ul, 15ul, 64ul, 255ul, 257ul, 4096ul, 40000ul}){
+                for(std::size_t misalign: {0ul, 1ul, 17ul, 63ul}){
+                    std::vector<char> dst(n + 128, '\x5a');
+                    copy(dst.data() + misalign, src.data() + 3, n, nontemporal);
+                    EXPECT_EQ(std::memcmp(dst.data() + misalign, src.data() + 3, n), 0);
+                    EXPECT_EQ(dst[misalign + n], '\x5a');
+                    if(misalign){
+                        EXPECT_EQ(dst[misalign - 1], '\x5a');
+                    }
+                }
+            }
+        }
+    }
+
+    EXPECT_EQ(effective_nontemporal_threshold(12345), 12345u);
+    EXPECT_LT(0u, effective_nontemporal_threshold(0));
+}
+
+TEST(CopyKernelTest, CompareTest)
+{
+    std::vector<char> a(1 << 12);
+    for(std::size_t i = 0; i < a.size(); ++i){
+        a[i] = static_cast<char>(i * 7 + i / 251);
+    }
+
+    for(copy_kernel k: {copy_kernel::AUTO, copy_kernel::PORTABLE,
+            copy_kernel::SSE2, copy_kernel::AVX2, copy_kernel::AVX512}){
+        if(!is_supported(k)){
+            EXPECT_THROW(select_compare_kernel(k), std::runtime_error);
+            continue;
+        }
+        const compare_function compare = select_compare_kernel(k);
+        for(std::size_t n: {0ul, 1ul, 63ul, 64ul, 65ul, 200ul, 4000ul}){
+            std::vector<char> b(a.begin() + 3, a.begin() + 3 + static_cast<long>(n));
+            EXPECT_EQ(compare(a.data() + 3, b.data(), n), n);
+            for(std::size_t at: {0ul, 1ul, 31ul, 32ul, 63ul, 64ul, 130ul, 3999ul}){
+                if(n <= at){
+                    continue;
+                }
+                b[at] ^= 0x10;
+                EXPECT_EQ(compare(a.data() + 3, b.data(), n), at) << "n: " << n;
+                b[at] ^= 0x10;
+            }
+        }
+    }
+}
+
+// the printf based formatter which target::hexdump() used to be.
+static std::string reference_hexdump(const char* data, std::size_t offset,
+        std::size_t length, std::size_t page_offset, int width, endian e)
+{
+    std::string out;
+    auto print = [&out](const char* format, auto... args){
+        char buf[256];
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+        std::snprintf(buf, sizeof(buf), format, args...);
+#pragma GCC diagnostic pop
+        out += buf;
+    };
+    auto fetch = [](const char* p, int w, endian en){
+        std::uint64_t v = 0;
+        std::memcpy(&v, p, static_cast<std::size_t>(w / 8));
+        const bool swap = 8 < w && en == endian::BIG;
+        return swap ? __builtin_bswap64(v) >> (64 - w) : v;
+    };
+
+    print(
+    "Offset%*s ""0       %s4        8       %sc         ASCII\n"
+    "%.*s "     "--------%s-----------------%s--------  ----------------\n",
+    2 * sizeof(std::size_t) - 6, "",             width < 64 ? " ": "", width < 64 ? " ": "",
+    2 * sizeof(std::size_t), "----------------", width < 64 ? "-": "", width < 64 ? "-": "");
+
+    std::size_t column_heading = offset & ~0xful;
+    bool needs_column_heading_print = true;
+    char ascii[0x10 + 2] = {'>'};
+
+    const std::size_t bytewise_width = static_cast<std::size_t>(width) / 8;
+    for(std::size_t i = page_offset & ~0xful; i < page_offset + length; i += bytewise_width){
+        if(needs_column_heading_print){
+            print("%0*zx", 2 * sizeof(std::size_t), column_heading);
+            column_heading += 0x10;
+            needs_column_heading_print = false;
+        }
+        if((i & 0x3) == 0x0){
+            print(" ");
+        }
+        if(i < page_offset){
+            print("%*s", 2 * static_cast<int>(bytewise_width), "");
+            std::snprintf(ascii, sizeof(ascii), "%*s>",
+                    static_cast<int>((i + bytewise_width) & ~(bytewise_width - 1)), "");
+        }else{
+            print("%0*lx", width / 4, fetch(data + i, width, e));
+            for(std::size_t j = 0; j < bytewise_width; ++j){
+                ascii[((i + j) & 0xful) + 1] = std::isprint(data[i + j]) ? data[i + j] : '.';
+            }
+        }
+        if(((i + bytewise_width) & 0xful) == 0x0){
+            print(" %s<\n", ascii);
+            std::memset(ascii, '\0', sizeof(ascii));
+            ascii[0] = '>';
+            needs_column_heading_print = true;
+        }
+    }
+
+    const std::size_t padding_for_hex = (0xful
+            - (((page_offset + length - 1 + bytewise_width) & ~(bytewise_width - 1)) & 0xful)
+            + 1) & 0xful;
+    const std::size_t padding_for_sep = ((~(page_offset + length -1)) >> 2 & 0x3);
+    print("%*s", static_cast<int>(2 * padding_for_hex + padding_for_sep), "");
+    if(ascii[1]){
+        print(" %s<\n", ascii);
+    }
+    return out;
+}
+
+static std::string formatted_hexdump(const char* data, std::size_t offset,
+        std::size_t length, std::size_t page_offset, int width, endian e)
+{
+    const hexdump_formatter formatter(data, offset, length, page_offset, width, e);
+    std::string out(hexdump_formatter::max_header_size
+            + formatter.lines() * hexdump_formatter::max_line_size, '\0');
+    std::size_t n = formatter.header(&out[0]);
+    n += formatter.format(&out[n], 0, formatter.lines());
+    out.resize(n);
+    return out;
+}
+
+TEST(SearchTest, FindTest)
+{
+    std::vector<char> data(1 << 14);
+    for(std::size_t i = 0; i < data.size(); ++i){
+        data[i] = static_cast<char>(i * 7 + i / 251);
+    }
+    for(std::size_t pos: {0x0ul, 0x3ul, 0x3ful, 0x101ul, 0x3ff8ul, 0x3ffcul}){
+        std::memcpy(data.data() + pos, "\x5f\x53\x4d\x5f", 4);
+    }
+
+    struct needle_spec{
+        const char* spec;
+        int width;
+        endian e;
+    };
+    const needle_spec specs[] = {
+        {"text:_SM_", 32, endian::HOST},
+        {"bytes:5f", 32, endian::HOST},
+        {"bytes:5f53", 32, endian::HOST},
+        {"text:\x07\x0e\x15\x1c\x23\x2a\x31", 32, endian::HOST},
+        {"word:0x5f", 8, endian::HOST},
+        {"word:0x5f53", 16, endian::BIG},
+        {"word:0x5f4d535f", 32, endian::LITTLE},
+        {"word:0x5f005300/0xff00ff00", 32, endian::LITTLE},
+        {"word:0x5f/0xff", 64, endian::LITTLE},
+    };
+    for(copy_kernel k: {copy_kernel::AUTO, copy_kernel::PORTABLE,
+            copy_kernel::SSE2, copy_kernel::AVX2, copy_kernel::AVX512}){
+        if(!is_supported(k)){
+            continue;
+        }
+        for(const needle_spec& s: specs){
+            const needle wanted(s.spec, s.width, s.e, k);
+            const bool word = std::string(s.spec).compare(0, 5, "word:") == 0;
+            const needle reference(s.spec, s.width, s.e, copy_kernel::PORTABLE);
+            // every match, found one by one from each misaligned start.
+            for(std::size_t misalign: {0ul, 1ul, 5ul}){
+                const char* p = data.data() + misalign;
+                const std::size_t n = data.size() - misalign;
+                std::vector<std::size_t> found, expected;
+                for(std::size_t i = wanted.find(p, n); i < n; i += 1 + wanted.find(p + i + 1, n - i - 1)){
+                    found.push_back(i);
+                }
+                const std::size_t size = wanted.size();
+                for(std::size_t i = 0; i + size <= n; ++i){
+                    const bool aligned = !word || reinterpret_cast<std::uintptr_t>(p + i) % size == 0;
+                    if(aligned && reference.find(p + i, size) == 0){
+                        expected.push_back(i);
+                    }
+                }
+                EXPECT_EQ(found, expected) << s.spec;
+                EXPECT_FALSE(expected.empty()) << s.spec;
+            }
+            // a region which ends before the first aligned word.
+            const std::size_t size = wanted.size();
+            const char* q = data.data()
+                + (size + 1 - reinterpret_cast<std::uintptr_t>(data.data()) % size) % size;
+            for(std::size_t n = 0; n < size; ++n){
+                EXPECT_EQ(wanted.find(q, n), n) << s.spec;
+            }
+        }
+    }
+
+    EXPECT_THROW(needle("bytes:5", 32, endian::HOST, copy_kernel::AUTO), std::runtime_error);
+    EXPECT_THROW(needle("word:0x100", 8, endian::HOST, copy_kernel::AUTO), std::runtime_error);
+    EXPECT_THROW(needle("text:", 32, endian::HOST, copy_kernel::AUTO), std::runtime_error);
+}
+
+TEST(HexdumpTest, SameAsReferenceTest)
+{
+    std::vector<char> page(0x200);
+    for(std::size_t i = 0; i < page.size(); ++i){
+        page[i] = static_cast<char>(i * 37 + 11);
+    }
+
+    for(int width: {8, 16, 32, 64}){
+        for(endian e: {endian::HOST, endian::BIG, endian::LITTLE}){
+            if(width == 8 && e != endian::HOST){
+                continue;
+            }
+            for(std::size_t page_offset = 0; page_offset < 0x28; ++page_offset){
+                for(std::size_t length = 1; length < 0x50; ++length){
+                    const std::size_t offset = 0xfe000000ul + page_offset;
+                    ASSERT_EQ(formatted_hexdump(page.data(), offset, length, page_offset, width, e),
+                            reference_hexdump(page.data(), offset, length, page_offset, width, e))
+                        << "width: " << width << ", page_offset: " << page_offset
+                        << ", length: " << length;
+                }
+            }
+        }
+    }
+}
+
+TEST(HistogramTest, PercentileTest)
+{
+    latency_histogram h;
+    EXPECT_EQ(h.count(), 0u);
+    EXPECT_EQ(h.percentile(0.5), 0u);
+
+    for(std::uint64_t v = 1; v <= 1000; ++v){
+        h.record(v);
+    }
+    h.record(UINT64_MAX);
+    EXPECT_EQ(h.count(), 1001u);
+    EXPECT_EQ(h.min(), 1u);
+    EXPECT_EQ(h.max(), UINT64_MAX);
+    EXPECT_EQ(h.percentile(0.0), 1u);
+    EXPECT_EQ(h.percentile(0.1), 101u);
+    for(double q: {0.5, 0.99, 0.999}){
+        const std::uint64_t exact = static_cast<std::uint64_t>(q * 1001 + 0.999);
+        EXPECT_GE(h.percentile(q), exact);
+        EXPECT_LE(h.percentile(q), exact + exact / 64);
+    }
+    EXPECT_EQ(h.percentile(1.0), UINT64_MAX);
+
+    const std::uint64_t t0 = tick_clock::now();
+    EXPECT_LE(t0, tick_clock::now());
+    EXPECT_GT(tick_clock::ticks_per_ns(), 0.0);
+
+    std::ostringstream oss;
+    h.report(oss);
+    EXPECT_EQ(oss.str().find("latency(ns): count 1001 min "), 0u);
+}
+
+TEST(MappingTest, ParseTest)
+{
+    mapping_policy policy;
+    EXPECT_TRUE(policy.populate);
+    parse_mapping_policy("lazy,sequential,hugepage", policy);
+    EXPECT_FALSE(policy.populate);
+    EXPECT_TRUE(policy.sequential);
+    EXPECT_FALSE(policy.willneed);
+    EXPECT_TRUE(policy.hugepage);
+    parse_mapping_policy("willneed,populate", policy);
+    EXPECT_TRUE(policy.populate);
+    EXPECT_TRUE(policy.willneed);
+
+    EXPECT_THROW(parse_mapping_policy("", policy), std::runtime_error);
+    EXPECT_THROW(parse_mapping_policy("lazy,", policy), std::runtime_error);
+    EXPECT_THROW(parse_mapping_policy("eager", policy), std::runtime_error);
 }
 
 TEST(TargetTest, ConstructionTest)
@@ -137,6 +624,25 @@ TEST(TargetTest, ConstructionTest)
         EXPECT_EQ(t2.offset()[0x1fff], 0);
     }
 
+    // in case of) region of regular file, in place of /dev/mem.
+    {
+        const char* file = "region.bin";
+        create_file(file, 0x3000);
+
+        target t1(file, target_role::DST, 0x1001, 0x1000);
+        EXPECT_EQ(t1.length(), 0x1000ul);
+        t1.offset()[0] = 'x';
+
+        target t2(file, target_role::SRC, 0x1000, 0x10);
+        EXPECT_EQ(t2.length(), 0x10ul);
+        EXPECT_EQ(t2.offset()[1], 'x');
+
+        struct stat buf;
+        EXPECT_EQ(stat(file, &buf), 0);
+        EXPECT_EQ(buf.st_size, 0x3000);
+        unlink(file);
+    }
+
     // in case of) directory.
     {
         const char* file = "/";
@@ -149,6 +655,511 @@ TEST(TargetTest, ConstructionTest)
     }
 }
 
+TEST(TargetTest, DeviceCacheTest)
+{
+    const char* file = "device.bin";
+    create_file(file, 0x8000);
+
+    // the first two ranges adjoin, and the third is apart from them.
+    device_cache cache;
+    cache.reserve(file, target_role::DST, 0x10, 0x10);
+    cache.reserve(file, target_role::DST, 0x1000, 0x1000);
+    cache.reserve(file, target_role::DST, 0x4000, 0x10);
+
+    target t1(cache, file, target_role::DST, 0x10, 0x10);
+    target t2(cache, file, target_role::DST, 0x1800, 0x10);
+    target t3(cache, file, target_role::DST, 0x4008, 0x8);
+    EXPECT_EQ(t2.offset() - t1.offset(), 0x17f0);
+    std::memset(t3.offset(), 'x', t3.length());
+
+    // ranges not reserved are mapped on the use, sharing the descriptor.
+    target t4(cache, file, target_role::DST, 0x4000, 0x10);
+    EXPECT_EQ(t3.offset() - t4.offset(), 0x8);
+    target t5(cache, file, target_role::DST, 0x6000, 0x10);
+    target t6(cache, file, target_role::SRC, 0x4008, 0x1);
+    EXPECT_EQ(t6.offset()[0], 'x');
+
+    // a range streamed through windows is not merged with the others.
+    device_cache windowed;
+    windowed.reserve(file, target_role::DST, 0x10, 0x10, 0x2000);
+    windowed.reserve(file, target_role::DST, 0x1000, 0x7000, 0x2000);
+    target t7(windowed, file, target_role::DST, 0x10, 0x10);
+    target t8(windowed, file, target_role::DST, 0x1010, 0x10);
+    EXPECT_NE(t8.offset() - t7.offset(), 0x1000);
+    std::memset(t8.offset(), 'y', t8.length());
+    EXPECT_EQ(t1.offset()[0x1000], 'y');
+    unlink(file);
+}
+
+TEST(ExecutorTest, RunAllTest)
+{
+    const char* file = "executor.bin";
+    const char* other = "executor-ro.bin";
+    create_file(file, 0x4000, "0123456789abcdef");
+    create_file(other, 0);
+    const int other_fd = open(other, O_RDONLY);
+
+    const auto range = [file](target_role role, std::size_t offset){
+        return std::make_shared<target>(file, role, offset, 0x10);
+    };
+    param prm;
+    prm.jobs = 4;
+    prm.transfers = {
+        {range(target_role::SRC, 0x0),    range(target_role::DST, 0x1000)},
+        {range(target_role::SRC, 0x1000), range(target_role::DST, 0x2000)},
+        {range(target_role::SRC, 0x3000), range(target_role::DST, 0x3800)},
+        {range(target_role::SRC, 0x0),    range(target_role::DST, 0x1008)},
+        // writing to a read-only descriptor fails, and the one reading the same file is skipped.
+        {range(target_role::SRC, 0x0),    std::make_shared<target>(other_fd)},
+        {std::make_shared<target>(other_fd), range(target_role::DST, 0x3c00)},
+    };
+
+    const executor e(prm);
+    ASSERT_EQ(e.size(), 6u);
+    EXPECT_EQ(e.dependencies(0), std::vector<std::size_t>{});
+    EXPECT_EQ(e.dependencies(1), std::vector<std::size_t>{0});
+    EXPECT_EQ(e.dependencies(2), std::vector<std::size_t>{});
+    EXPECT_EQ(e.dependencies(3), (std::vector<std::size_t>{0, 1}));
+    EXPECT_EQ(e.dependencies(4), std::vector<std::size_t>{});
+    EXPECT_EQ(e.dependencies(5), std::vector<std::size_t>{4});
+
+    EXPECT_EQ(e.run_all(), 2u);
+    EXPECT_EQ(read_file(file, 0x10, 0x2000), "0123456789abcdef");
+    EXPECT_EQ(read_file(file, 0x18, 0x1000), "012345670123456789abcdef");
+
+    // searches and comparisons write their results to stdout in order, as a transfer to it does.
+    prm.search = "text:0123";
+    prm.transfers = {
+        {range(target_role::SRC, 0x0),    nullptr},
+        {range(target_role::SRC, 0x1000), nullptr},
+        {range(target_role::SRC, 0x0),    range(target_role::SRC, 0x2000), true},
+        {range(target_role::SRC, 0x3000), std::make_shared<target>(STDOUT_FILENO)},
+        {range(target_role::SRC, 0x3000), range(target_role::DST, 0x3800)},
+    };
+    const executor results(prm);
+    EXPECT_EQ(results.dependencies(1), std::vector<std::size_t>{0});
+    EXPECT_EQ(results.dependencies(2), (std::vector<std::size_t>{0, 1}));
+    EXPECT_EQ(results.dependencies(3), (std::vector<std::size_t>{0, 1, 2}));
+    EXPECT_EQ(results.dependencies(4), std::vector<std::size_t>{});
+    close(other_fd);
+    unlink(file);
+    unlink(other);
+}
+
+TEST(TargetTest, RegisterTest)
+{
+    const char* file = "register.bin";
+    std::vector<char> page(0x1000);
+    for(std::size_t i = 0; i < page.size(); ++i){
+        page[i] = static_cast<char>(i * 37 + 11);
+    }
+    create_file(file, 0x2000, std::string(page.begin(), page.end()), 0x1000);
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    const auto drain = [&fds](){
+        char buf[0x1000];
+        const ssize_t n = read(fds[0], buf, sizeof(buf));
+        return std::string(buf, n < 0 ? 0 : static_cast<std::size_t>(n));
+    };
+
+    // peeks, formatted or not.
+    const target regs(file, target_role::SRC, 0x1013, 0x1d);
+    param prm;
+    prm.hexdump_enabled = true;
+    for(int width: {8, 16, 32, 64}){
+        prm.width = width;
+        EXPECT_EQ(regs.transfer_to(target(fds[1]), prm), 0);
+        EXPECT_EQ(drain(), formatted_hexdump(page.data(), 0x1013, 0x1d, 0x13, width, endian::HOST));
+    }
+    prm.hexdump_enabled = false;
+    EXPECT_EQ(regs.transfer_to(target(fds[1]), prm), 0);
+    EXPECT_EQ(drain(), std::string(page.data() + 0x13, 0x1d));
+
+    // pokes, from a stream and from registers.
+    EXPECT_EQ(write(fds[1], "abcdefgh", 8), 8);
+    close(fds[1]);
+    EXPECT_EQ(target(fds[0]).transfer_to(target(file, target_role::DST, 0x1101, 0x10), prm), 0);
+    EXPECT_EQ(regs.transfer_to(target(file, target_role::DST, 0x1200, 0x1d), prm), 0);
+    close(fds[0]);
+
+    EXPECT_EQ(read_file(file, 0x9, 0x1100), std::string(1, page[0x100]) + "abcdefgh");
+    EXPECT_EQ(read_file(file, 0x1d, 0x1200), std::string(page.data() + 0x13, 0x1d));
+    unlink(file);
+}
+
+TEST(TargetTest, CompareTest)
+{
+    const char* file = "compare.bin";
+    std::vector<char> data(0x8000);
+    for(std::size_t i = 0; i < data.size(); ++i){
+        data[i] = static_cast<char>(i * 37 + 11);
+    }
+    create_file(file, 0x20000, std::string(data.begin(), data.end()), 0x1000);
+    write_file(file, std::string(data.begin(), data.end()), 0x11002);
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    param prm;
+    prm.jobs = 4;
+    prm.chunk_size = 0x1000;
+    const target src(file, target_role::SRC, 0x1000, 0x8000);
+    const target ref(file, target_role::SRC, 0x11002, 0x8000);
+    EXPECT_EQ(src.compile_compare(ref, prm, fds[1])(), 0);
+
+    // the words are aligned to their addresses in SRC, and cut at its ends.
+    const std::pair<std::size_t, int> diffs[] = {
+        {0x0, 0x01}, {0x3, 0x10}, {0x2001, 0x01}, {0x2002, 0x02}, {0x7fff, 0x80}};
+    for(const auto& [pos, bit]: diffs){
+        data[pos] = static_cast<char>(data[pos] ^ bit);
+    }
+    write_file(file, std::string(data.begin(), data.end()), 0x11002);
+    EXPECT_EQ(src.compile_compare(ref, prm, fds[1])(), target::differ);
+    close(fds[1]);
+
+    char buf[0x1000];
+    const ssize_t n = read(fds[0], buf, sizeof(buf));
+    close(fds[0]);
+    const auto word = [&data](std::size_t pos){
+        std::uint32_t w;
+        std::memcpy(&w, data.data() + pos, sizeof(w));
+        return w;
+    };
+    char expected[0x400];
+    const int len = std::snprintf(expected, sizeof(expected),
+            "Offset           SRC      DST\n"
+            "0000000000001000 %08x %08x\n"
+            "0000000000003000 %08x %08x\n"
+            "0000000000008ffc %08x %08x\n",
+            word(0) ^ 0x10000001u, word(0),
+            word(0x2000) ^ 0x00020100u, word(0x2000),
+            word(0x7ffc) ^ 0x80000000u, word(0x7ffc));
+    EXPECT_EQ(std::string(buf, n < 0 ? 0 : static_cast<std::size_t>(n)), std::string(expected, static_cast<std::size_t>(len)));
+
+    // the lengths differ.
+    EXPECT_EQ(src.compile_compare(target(file, target_role::SRC, 0x11002, 0x7fff), prm, -1)(), target::differ);
+    unlink(file);
+}
+
+TEST(TargetTest, PatternTest)
+{
+    EXPECT_TRUE(pattern::is_pattern("pattern:0x1"));
+    EXPECT_FALSE(pattern::is_pattern("./zero"));
+    EXPECT_THROW(pattern::parse("pattern:0x1g", 32, endian::HOST), std::runtime_error);
+    EXPECT_THROW(pattern::parse("pattern:0x100", 8, endian::HOST), std::runtime_error);
+
+    const char* file = "pattern.bin";
+    create_file(file, 0x40000);
+    param prm;
+    prm.jobs = 4;
+    prm.chunk_size = 0x1000;
+    prm.nontemporal_threshold = 1;
+
+    // a constant, from the middle of a word at both ends.
+    const target constant(pattern::parse("pattern:0xdeadbeef", 32, endian::BIG));
+    EXPECT_EQ(constant.transfer_to(target(file, target_role::DST, 0x3, 0x20003), prm), 0);
+    // words which count up, in little endian.
+    const target incr(pattern::parse("incr", 16, endian::LITTLE));
+    EXPECT_EQ(incr.transfer_to(target(file, target_role::DST, 0x21000, 0x1e000), prm), 0);
+    // registers.
+    const target zero(pattern::parse("zero", 8, endian::HOST));
+    EXPECT_EQ(zero.transfer_to(target(file, target_role::DST, 0x1005, 0x10), prm), 0);
+
+    const std::string data = read_file(file, 0x40000);
+    ASSERT_EQ(data.size(), 0x40000u);
+    const unsigned char beef[] = {0xde, 0xad, 0xbe, 0xef};
+    for(std::size_t i = 0; i < 0x20003; ++i){
+        const std::size_t pos = 0x3 + i;
+        const unsigned char expected = 0x1005 <= pos && pos < 0x1015 ? 0 : beef[i % 4];
+        ASSERT_EQ(static_cast<unsigned char>(data[pos]), expected) << pos;
+    }
+    for(std::size_t i = 0; i < 0x1e000; ++i){
+        ASSERT_EQ(static_cast<unsigned char>(data[0x21000 + i]), static_cast<unsigned char>(i % 2 ? i >> 9 : i >> 1)) << i;
+    }
+
+    // the generated blocks are summed, which are the same as what is filled.
+    std::string filled(0x2345, '\0');
+    for(const char* spec: {"pattern:0xdeadbeef", "incr", "zero"}){
+        checksum sum(checksum_algorithm::HASH64);
+        pattern::parse(spec, 32, endian::BIG).fill(&filled[0], 0x3, filled.size(),
+                select_copy_kernel(prm.kernel), false, &sum);
+        EXPECT_EQ(sum.value(), sum.compute(filled.data(), filled.size())) << spec;
+    }
+
+    // nothing to fill.
+    EXPECT_THROW(constant.transfer_to(target(STDOUT_FILENO), prm), std::runtime_error);
+    unlink(file);
+}
+
+TEST(TargetTest, SearchTest)
+{
+    const char* file = "search.bin";
+    create_file(file, 0x40000);
+    // across a chunk, across a window, and at the end.
+    for(off_t pos: {0x0ffe, 0x1ffff, 0x3fffc}){
+        write_file(file, "_SM_", pos);
+    }
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    param prm;
+    prm.jobs = 4;
+    prm.chunk_size = 0x1000;
+    mapping_policy policy;
+    policy.window = 0x10000;
+    const target src(file, target_role::SRC, 0, 0, policy);
+    prm.search = "text:_SM_";
+    EXPECT_EQ(src.compile_search(prm, fds[1])(), 0);
+    prm.search = "word:0x5f00005f/0xff0000ff";
+    prm.endianness = endian::BIG;
+    EXPECT_EQ(src.compile_search(prm, fds[1])(), 0);
+    prm.search = "text:_SM_X";
+    EXPECT_EQ(src.compile_search(prm, fds[1])(), target::not_found);
+    close(fds[1]);
+
+    char buf[0x1000];
+    const ssize_t n = read(fds[0], buf, sizeof(buf));
+    close(fds[0]);
+    EXPECT_EQ(std::string(buf, n < 0 ? 0 : static_cast<std::size_t>(n)),
+            "0000000000000ffe\n"
+            "000000000001ffff\n"
+            "000000000003fffc\n"
+            "000000000003fffc\n");
+
+    EXPECT_THROW(target(STDIN_FILENO).compile_search(prm, -1), std::runtime_error);
+    unlink(file);
+}
+
+TEST(WorkerPoolTest, RunTest)
+{
+    worker_pool& pool = worker_pool::instance(0, 4);
+    EXPECT_EQ(&pool, &worker_pool::instance(0, 2));
+    EXPECT_GE(pool.size(), 3u);
+
+    for(std::size_t count: {0ul, 1ul, 3ul, 4ul, 100ul}){
+        std::vector<std::atomic<int>> hits(count);
+        pool.run(count, 4, [&hits](std::size_t i){++hits.at(i);});
+        for(const auto& h: hits){
+            EXPECT_EQ(h, 1);
+        }
+    }
+
+    std::atomic<int> finished(0);
+    EXPECT_THROW(pool.run(8, 4, [&finished](std::size_t i){
+        if(i == 5){
+            throw std::runtime_error("task failure");
+        }
+        ++finished;
+    }), std::runtime_error);
+    EXPECT_EQ(finished, 7);
+
+    std::atomic<int> running(0);
+    std::atomic<int> peak(0);
+    pool.run(64, 2, [&running, &peak](std::size_t){
+        const int r = ++running;
+        for(int p = peak; p < r && !peak.compare_exchange_weak(p, r);){}
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        --running;
+    });
+    EXPECT_LE(peak, 2);
+}
+
+TEST(WorkerPoolTest, RunChunkedTest)
+{
+    worker_pool& pool = worker_pool::instance(0, 4);
+    for(const std::size_t origin: {0ul, 0x10ul, 0xff0ul}){
+        for(const std::size_t n: {0ul, 1ul, 0x1000ul, 0x1010ul, 0x23456ul}){
+            for(const std::size_t jobs: {1ul, 3ul, 4ul}){
+                std::vector<std::atomic<int>> hits(n);
+                std::mutex mutex;
+                std::vector<std::pair<std::size_t, std::size_t>> chunks;
+                pool.run_chunked(origin, n, 0x1000, jobs, [&](std::size_t first, std::size_t last){
+                    for(std::size_t i = first; i < last; ++i){
+                        ++hits.at(i);
+                    }
+                    std::lock_guard<std::mutex> lock(mutex);
+                    chunks.emplace_back(first, last);
+                });
+                for(const auto& h: hits){
+                    EXPECT_EQ(h, 1);
+                }
+                // the chunks end at pages counted from 'origin', but for the last one.
+                for(const auto& [first, last]: chunks){
+                    EXPECT_LT(first, last);
+                    EXPECT_TRUE(last == n || (origin + last) % 0x1000 == 0);
+                    if(1 < jobs){
+                        EXPECT_LE(last - first, 0x1000u);
+                    }
+                }
+            }
+        }
+    }
+
+    // a worker which has run out of its own chunks takes the others' from the back.
+    chunk_scheduler scheduler(5, 2);
+    std::size_t i = 0;
+    std::vector<std::size_t> taken;
+    while(scheduler.next(0, i)){
+        taken.push_back(i);
+    }
+    EXPECT_EQ(taken, (std::vector<std::size_t>{0, 1, 4, 3, 2}));
+    EXPECT_FALSE(scheduler.next(1, i));
+}
+
+TEST(ServerTest, RequestTest)
+{
+    // a regular file stands in for /dev/mem.
+    const char* device = "device.bin";
+    std::string data(0x2000, '\0');
+    for(std::size_t i = 0; i < data.size(); ++i){
+        data[i] = static_cast<char>(i);
+    }
+    create_file(device, 0x2000, data);
+
+    param prm;
+    prm.device = device;
+    const char* sock = "masterkey.sock";
+
+    // anything but a socket is left as it is.
+    create_file(sock, 0);
+    EXPECT_THROW(server(sock, prm), std::runtime_error);
+    struct stat buf;
+    EXPECT_EQ(lstat(sock, &buf), 0);
+    EXPECT_TRUE(S_ISREG(buf.st_mode));
+    unlink(sock);
+
+    std::unique_ptr<server> s(new server(sock, prm));
+    EXPECT_EQ(lstat(sock, &buf), 0);
+    EXPECT_EQ(buf.st_mode & (S_IRWXG | S_IRWXO), 0u);
+    std::thread th([&s](){EXPECT_EQ(s->run(), 0);});
+
+    const char* out_file = "out.bin";
+    auto read_out = [out_file](){
+        std::ostringstream oss;
+        oss << std::ifstream(out_file).rdbuf();
+        return oss.str();
+    };
+
+    // replies come in order, from any number of clients at once.
+    std::vector<std::thread> clients;
+    for(int i = 0; i < 4; ++i){
+        clients.emplace_back([sock, i](){
+            const std::string file = "out" + std::to_string(i) + ".bin";
+            const int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+            std::vector<std::string> specs;
+            for(int j = 0; j < 100; ++j){
+                specs.push_back("4@" + std::to_string(i * 4) + ":-");
+            }
+            EXPECT_EQ(request(sock, specs, fd), 0);
+            close(fd);
+            std::ostringstream oss;
+            oss << std::ifstream(file).rdbuf();
+            EXPECT_EQ(oss.str().size(), 400u);
+            for(std::size_t k = 0; k < oss.str().size(); ++k){
+                EXPECT_EQ(oss.str()[k], static_cast<char>(i * 4 + k % 4));
+            }
+            unlink(file.c_str());
+        });
+    }
+    for(auto& c: clients){
+        c.join();
+    }
+
+    // replies larger than the server keeps are sent as they are taken.
+    {
+        const int fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        EXPECT_EQ(request(sock, std::vector<std::string>(200, "0x2000@0:-"), fd), 0);
+        close(fd);
+        std::string expected;
+        for(int i = 0; i < 200; ++i){
+            expected += data;
+        }
+        EXPECT_EQ(read_out(), expected);
+    }
+
+    // a batch whose requests and replies both exceed what the sockets and the server
+    // keep is sent while the replies are read.
+    {
+        const int fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        const std::string spec = "0x40@0x" + std::string(40, '0') + "100:-";
+        EXPECT_EQ(request(sock, std::vector<std::string>(30000, spec), fd), 0);
+        close(fd);
+        EXPECT_EQ(read_out().size(), 30000u * 0x40);
+    }
+
+    // a range written through the server is read back through it.
+    {
+        const int fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        EXPECT_EQ(request(sock, {"2@0x10:2@0x1000", "4@0x1000:-"}, fd), 0);
+        close(fd);
+        EXPECT_EQ(read_out(), std::string("\x10\x11\x02\x03", 4));
+    }
+
+    // a failed request doesn't prevent the following ones.
+    {
+        const int fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        EXPECT_NE(request(sock, {"no/such/file:-", "-:4@0", "1@0:-"}, fd), 0);
+        close(fd);
+        EXPECT_EQ(read_out(), std::string(1, '\0'));
+    }
+
+    s->stop();
+    th.join();
+    s.reset();
+    unlink(out_file);
+    unlink(device);
+
+    EXPECT_EQ(stat(sock, &buf), -1);
+    EXPECT_NE(request(sock, {"1@0:-"}, -1), 0);
+}
+
+TEST(StatsTest, EmitTest)
+{
+    EXPECT_FALSE(stats::enabled());
+    EXPECT_THROW(stats::enable("xml"), std::runtime_error);
+    EXPECT_THROW(stats::enable("json:"), std::runtime_error);
+    EXPECT_THROW(stats::enable("json:3x"), std::runtime_error);
+    EXPECT_THROW(stats::enable("json:1000000"), std::runtime_error);
+    EXPECT_FALSE(stats::enabled());
+
+    const char* file = "stats.txt";
+    const int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    ASSERT_NE(fd, -1);
+
+    param prm;
+    prm.jobs = 2;
+    for(const char* format: {"csv", "json"}){
+        stats::enable(std::string(format) + ':' + std::to_string(fd));
+        EXPECT_TRUE(stats::enabled());
+        const target src("/dev/zero", target_role::DST, 0, 1 << 20);
+        const target dst("/dev/zero", target_role::DST, 0, 1 << 20);
+        stats::emit("setup", -1, -1);
+        EXPECT_EQ(src.transfer_to(dst, prm), 0);
+        stats::emit("transfer", 0, 1);
+    }
+    stats::disable();
+    stats::emit("transfer", 0, 2);
+    close(fd);
+
+    std::ifstream ifs(file);
+    std::vector<std::string> lines;
+    for(std::string line; std::getline(ifs, line);){
+        lines.push_back(line);
+    }
+    ASSERT_EQ(lines.size(), 5u);
+    EXPECT_EQ(lines.at(0), "stage,repeat,transfer,open_ns,fstat_ns,mmap_ns,copy_ns,"
+            "msync_ns,fsync_ns,bytes,syscalls,threads");
+    EXPECT_EQ(lines.at(1).find("setup,,,"), 0u);
+    EXPECT_EQ(lines.at(2).find("transfer,0,1,0,0,0,"), 0u);
+    EXPECT_NE(lines.at(2).find(",1048576,"), std::string::npos);
+    EXPECT_EQ(lines.at(3).find("{\"stage\": \"setup\", \"repeat\": null, \"transfer\": null, "), 0u);
+    EXPECT_EQ(lines.at(4).find("{\"stage\": \"transfer\", \"repeat\": 0, \"transfer\": 1, "
+                "\"open_ns\": 0, \"fstat_ns\": 0, \"mmap_ns\": 0, "), 0u);
+    EXPECT_NE(lines.at(4).find("\"bytes\": 1048576, "), std::string::npos);
+    EXPECT_NE(lines.at(4).find("\"threads\": 2}"), std::string::npos);
+    unlink(file);
+}
+
 class TransferFromMmapTest: public ::testing::Test{
 protected:
     TransferFromMmapTest():
@@ -181,9 +1192,98 @@ TEST_F(TransferFromMmapTest, ToMmappedTest)
     }
 }
 
+TEST_F(TransferFromMmapTest, ToMmappedPinnedTest)
+{
+    // the calling thread is pinned only while the transfer runs.
+    cpu_set_t saved;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(saved), &saved), 0);
+
+    prm.cpus = {0};
+    prm.numa_node = 0;
+    target dst("/dev/zero", target_role::DST, 0, src.length() + 5);
+    EXPECT_EQ(src.transfer_to(dst, prm), 0);
+    EXPECT_EQ(std::memcmp(dst.offset(), src.offset(), src.length()), 0);
+
+    cpu_set_t after;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(after), &after), 0);
+    EXPECT_TRUE(CPU_EQUAL(&saved, &after));
+}
+
+TEST_F(TransferFromMmapTest, ToMmappedNonTemporalTest)
+{
+    prm.nontemporal_threshold = 1;
+    target dst("/dev/zero", target_role::DST, 3, src.length() - 3);
+    EXPECT_EQ(src.transfer_to(dst, prm), 0);
+    EXPECT_EQ(std::memcmp(dst.offset(), src.offset(), dst.length()), 0);
+}
+
+TEST_F(TransferFromMmapTest, ChecksumTest)
+{
+    prm.checksum = checksum_algorithm::HASH64;
+    prm.chunk_size = 12288;
+    std::ostringstream expected;
+    expected << std::hex << std::setfill('0') << std::setw(16)
+        << checksum(prm.checksum).compute(src.offset(), src.length());
+
+    // stderr is captured while the data is copied, written and passed through.
+    const char* err_file = "err.txt";
+    const char* dst_file = "out.bin";
+    const int saved = dup(STDERR_FILENO);
+    const int err = open(err_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(err, STDERR_FILENO);
+    {
+        target dst("/dev/zero", target_role::DST, 0, src.length());
+        EXPECT_EQ(src.transfer_to(dst, prm), 0);
+        target file(dst_file, target_role::DST);
+        EXPECT_EQ(src.transfer_to(file, prm), 0);
+        const int in_fd = open(dst_file, O_RDONLY);
+        const int out_fd = open("/dev/null", O_WRONLY);
+        EXPECT_EQ(target(in_fd).transfer_to(target(out_fd), prm), 0);
+        close(in_fd);
+        close(out_fd);
+    }
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+    close(err);
+
+    std::ifstream ifs(err_file);
+    std::size_t count = 0;
+    for(std::string line; std::getline(ifs, line);){
+        if(line.find(": hash64 ") != std::string::npos){
+            EXPECT_EQ(line.substr(line.size() - 16), expected.str());
+            ++count;
+        }
+    }
+    EXPECT_EQ(count, 3u);
+    unlink(err_file);
+    unlink(dst_file);
+}
+
+TEST_F(TransferFromMmapTest, HexdumpTest)
+{
+    prm.hexdump_enabled = true;
+    for(auto [width, jobs]: {std::pair{8, 1}, {16, 4}, {32, 3}, {64, 4}}){
+        prm.width = width;
+        prm.jobs = jobs;
+        const char* dst_file = "out.txt";
+        {
+            target dst(dst_file, target_role::DST);
+            EXPECT_EQ(src.transfer_to(dst, prm), 0);
+        }
+        std::ostringstream oss;
+        oss << std::ifstream(dst_file).rdbuf();
+        EXPECT_EQ(oss.str(), reference_hexdump(src.offset(), 0, src.length(), 0,
+                    width, endian::HOST));
+        unlink(dst_file);
+    }
+}
+
 TEST_F(TransferFromMmapTest, ToRegularTest)
 {
+    EXPECT_THROW(to_sync_mode("async"), std::runtime_error);
+    const sync_mode modes[] = {sync_mode::FULL, sync_mode::DATA, sync_mode::NONE, sync_mode::FULL};
     for(int i: {0, 1, 2, 3}){
+        prm.sync = modes[i];
         target tmp("/dev/zero", target_role::DST, 0, src.length() - i);
         EXPECT_EQ(src.transfer_to(tmp, prm), 0);
         const char* dst_file = "out.bin";
@@ -195,6 +1295,101 @@ TEST_F(TransferFromMmapTest, ToRegularTest)
     }
 }
 
+TEST_F(TransferFromMmapTest, ToRegularUringTest)
+{
+    prm.engine = io_engine::URING;
+    for(auto [depth, block]: {std::pair{1u, 1ul << 20}, {4u, 4099ul}, {64u, 1ul << 16}}){
+        prm.queue_depth = depth;
+        prm.block_size = block;
+        const char* dst_file = "out.bin";
+        {
+            target dst(dst_file, target_role::DST);
+            EXPECT_EQ(src.transfer_to(dst, prm), 0);
+            EXPECT_EQ(dst.length(), src.length());
+        }
+        target dst(dst_file, target_role::SRC);
+        EXPECT_EQ(dst.length(), src.length());
+        EXPECT_EQ(std::memcmp(dst.offset(), src.offset(), src.length()), 0);
+        unlink(dst_file);
+    }
+}
+
+TEST_F(TransferFromMmapTest, PassthroughTest)
+{
+    const char* in_file = "in.bin";
+    const char* out_file = "out.bin";
+    {
+        target in(in_file, target_role::DST);
+        EXPECT_EQ(src.transfer_to(in, prm), 0);
+    }
+
+    auto expect_same_as_src = [this, out_file](){
+        target dst(out_file, target_role::SRC);
+        EXPECT_EQ(dst.length(), src.length());
+        EXPECT_EQ(std::memcmp(dst.offset(), src.offset(), src.length()), 0);
+        unlink(out_file);
+    };
+
+    // file to file, through copy_file_range.
+    {
+        const int fd = open(in_file, O_RDONLY);
+        target dst(out_file, target_role::DST);
+        EXPECT_EQ(target(fd).transfer_to(dst, prm), 0);
+        EXPECT_EQ(dst.length(), src.length());
+        close(fd);
+        expect_same_as_src();
+    }
+
+    // file to pipe through sendfile, and pipe to file through splice.
+    {
+        int pipefd[2];
+        EXPECT_EQ(pipe(pipefd), 0);
+        std::thread th([&](){
+            const int fd = open(in_file, O_RDONLY);
+            EXPECT_EQ(target(fd).transfer_to(target(pipefd[1]), prm), 0);
+            close(fd);
+            close(pipefd[1]);
+        });
+        {
+            target dst(out_file, target_role::DST);
+            EXPECT_EQ(target(pipefd[0]).transfer_to(dst, prm), 0);
+        }
+        th.join();
+        close(pipefd[0]);
+        expect_same_as_src();
+    }
+
+    // a file of procfs, which claims to be empty, but isn't.
+    {
+        const int fd = open("/proc/self/status", O_RDONLY);
+        target dst(out_file, target_role::DST);
+        EXPECT_EQ(target(fd).transfer_to(dst, prm), 0);
+        EXPECT_LT(0u, dst.length());
+        close(fd);
+        unlink(out_file);
+    }
+
+    // socket to file, through the buffer.
+    {
+        prm.buffer_size = 1000;
+        int sv[2];
+        EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+        std::thread th([&](){
+            EXPECT_EQ(src.transfer_to(target(sv[1]), prm), 0);
+            close(sv[1]);
+        });
+        {
+            target dst(out_file, target_role::DST);
+            EXPECT_EQ(target(sv[0]).transfer_to(dst, prm), 0);
+        }
+        th.join();
+        close(sv[0]);
+        expect_same_as_src();
+    }
+
+    unlink(in_file);
+}
+
 TEST_F(TransferFromMmapTest, ToPipeTest)
 {
     int pipefd[2];
@@ -215,6 +1410,150 @@ TEST_F(TransferFromMmapTest, ToPipeTest)
     EXPECT_EQ(std::memcmp(dst2.offset(), src.offset(), dst2.length()), 0);
 }
 
+TEST_F(TransferFromMmapTest, ToPipeUnalignedTest)
+{
+    target src2("/dev/zero", target_role::DST, 0x123, 0x3456);
+    std::memcpy(src2.offset(), src.offset(), src2.length());
+
+    int pipefd[2];
+    EXPECT_EQ(pipe(pipefd), 0);
+    std::thread th([&](){
+        EXPECT_EQ(src2.transfer_to(target(pipefd[1]), prm), 0);
+        close(pipefd[1]);
+    });
+
+    std::vector<char> buf(src2.length() + 1);
+    std::size_t count = 0;
+    ssize_t ret;
+    while((ret = read(pipefd[0], buf.data() + count, buf.size() - count)) > 0){
+        count += static_cast<std::size_t>(ret);
+    }
+    th.join();
+    close(pipefd[0]);
+
+    EXPECT_EQ(count, src2.length());
+    EXPECT_EQ(std::memcmp(buf.data(), src.offset(), src2.length()), 0);
+}
+
+TEST_F(TransferFromMmapTest, ToPipeSnapshotTest)
+{
+    // what is written to a pipe stays as it was, even if the region is written
+    // before the reader gets to it.
+    target src2("/dev/zero", target_role::DST, 0, 0x3000);
+    std::memcpy(src2.offset(), src.offset(), src2.length());
+
+    int pipefd[2];
+    EXPECT_EQ(pipe(pipefd), 0);
+    EXPECT_LE(0x3000, fcntl(pipefd[1], F_SETPIPE_SZ, 0x10000));
+    EXPECT_EQ(src2.transfer_to(target(pipefd[1]), prm), 0);
+    close(pipefd[1]);
+    std::memset(src2.offset(), 0xff, src2.length());
+
+    std::vector<char> buf(src2.length());
+    EXPECT_EQ(read(pipefd[0], buf.data(), buf.size()), 0x3000);
+    close(pipefd[0]);
+    EXPECT_EQ(std::memcmp(buf.data(), src.offset(), buf.size()), 0);
+}
+
+TEST_F(TransferFromMmapTest, CompileTest)
+{
+    // a compiled plan moves the data again each time it's called.
+    target dst("/dev/zero", target_role::DST, 0, src.length());
+    const std::function<int()> plan = src.compile(dst, prm);
+    for(int i = 0; i < 3; ++i){
+        std::memset(dst.offset(), 0, dst.length());
+        EXPECT_EQ(plan(), 0);
+        EXPECT_EQ(std::memcmp(dst.offset(), src.offset(), src.length()), 0);
+    }
+
+    // the source file is read from the beginning each time.
+    const char* in_file = "in.bin";
+    {
+        target in(in_file, target_role::DST);
+        EXPECT_EQ(src.transfer_to(in, prm), 0);
+    }
+    const int fd = open(in_file, O_RDONLY);
+    const target in(fd);
+    const std::function<int()> read_plan = in.compile(dst, prm);
+    for(int i = 0; i < 2; ++i){
+        std::memset(dst.offset(), 0, dst.length());
+        EXPECT_EQ(read_plan(), 0);
+        EXPECT_EQ(std::memcmp(dst.offset(), src.offset(), src.length()), 0);
+    }
+    close(fd);
+    unlink(in_file);
+}
+
+TEST_F(TransferFromMmapTest, StreamedTest)
+{
+    const char* in_file = "in.bin";
+    const char* out_file = "out.bin";
+    const std::size_t length = src.length() - 5;
+    {
+        target in(in_file, target_role::DST);
+        EXPECT_EQ(src.transfer_to(in, prm), 0);
+        EXPECT_EQ(truncate(in_file, static_cast<off_t>(length)), 0);
+    }
+
+    for(std::size_t window: {1ul, 0x10001ul, 1ul << 20}){
+        mapping_policy policy;
+        policy.window = window;
+        const target in(in_file, target_role::SRC, 0, 0, policy);
+        EXPECT_TRUE(in.is_mapped());
+
+        {
+            target dst("/dev/zero", target_role::DST, 0, length);
+            EXPECT_EQ(in.transfer_to(dst, prm), 0);
+            EXPECT_EQ(std::memcmp(dst.offset(), src.offset(), length), 0);
+        }
+
+        {
+            {
+                target dst(out_file, target_role::DST);
+                EXPECT_EQ(in.transfer_to(dst, prm), 0);
+            }
+            target dst(out_file, target_role::SRC);
+            EXPECT_EQ(dst.length(), length);
+            EXPECT_EQ(std::memcmp(dst.offset(), src.offset(), length), 0);
+        }
+
+        prm.hexdump_enabled = true;
+        {
+            target dst(out_file, target_role::DST);
+            EXPECT_EQ(in.transfer_to(dst, prm), 0);
+        }
+        prm.hexdump_enabled = false;
+        std::ostringstream oss;
+        oss << std::ifstream(out_file).rdbuf();
+        EXPECT_EQ(oss.str(), reference_hexdump(src.offset(), 0, length, 0, 32, endian::HOST));
+    }
+
+    unlink(out_file);
+    unlink(in_file);
+}
+
+TEST_F(TransferFromMmapTest, MappingPolicyTest)
+{
+    const char* in_file = "in.bin";
+    {
+        target in(in_file, target_role::DST);
+        EXPECT_EQ(src.transfer_to(in, prm), 0);
+    }
+
+    for(const char* str: {"lazy", "populate,sequential", "lazy,willneed", "hugepage,sequential"}){
+        mapping_policy policy;
+        parse_mapping_policy(str, policy);
+        policy.window = 3 << 20;
+        const target in(in_file, target_role::SRC, 0, 0, policy);
+        target dst("/dev/zero", target_role::DST, 0x10, src.length(), policy);
+        dst.mmap(PROT_WRITE);
+        EXPECT_EQ(in.transfer_to(dst, prm), 0);
+        EXPECT_EQ(std::memcmp(dst.offset(), src.offset(), src.length()), 0);
+    }
+
+    unlink(in_file);
+}
+
 class TransferFromPipeTest: public TransferFromMmapTest{
 protected:
     TransferFromPipeTest():
@@ -261,7 +1600,11 @@ protected:
         close(pipefd[0]);
         close(pipefd[1]);
         thread_.join();
+        pipefd[0] = pipefd[1] = 0;
         thread_ = std::thread(pipe_input, pipefd, src);
+        while(pipefd[0] == 0 || pipefd[1] == 0){
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
     }
 
     int pipefd[2];